@@ -0,0 +1,452 @@
+/**
+ * Host test for the FFT of fft_new.c
+ *
+ * Builds the FFT code of fft_new.c on a PC and checks its spectra of
+ * 8-bit ADC style test signals (Hann windowed, as the demo does) against
+ *  - the radix-2 FFTfix of fft.c (copied below as FFTradix2), which
+ *    computes the full complex FFT of NUM_SAMPLES points
+ *  - a double-precision DFT
+ * For each signal and FFT length it prints the SNR of the spectrum (bins 0
+ * to N/2) against the DFT, and fails if FFTreal is below MIN_SNR_DB or
+ * more than SNR_SLACK_DB worse than FFTradix2.
+ *
+ * Then it compares block floating point (fft_block_float) with fixed
+ * scaling at input levels from full scale down to -36 dB. It fails if
+ * block floating point is ever worse than fixed scaling (by more than
+ * BLOCK_SLACK_DB, for rounding at full scale). Last, it runs stress
+ * inputs (a square wave, DC, Nyquist and a tone on a bin) unwindowed and
+ * scaled up to 2^27, the most FFTfix takes, and fails if either scaling
+ * falls below MIN_SNR_DB there, which is what an overflow would do.
+ *
+ * Finally it checks the pitch find_peaks reads off the spectrum, for
+ * tones from 80 Hz to 2 kHz (with noise, and then with a quieter fifth
+ * above), at 1024 and 256 points, against the nearest bin. It fails if
+ * the error goes over MAX_CENTS_1024 or MAX_CENTS_256 cents.
+ *
+ * BUILD
+ *   cc -O2 -o fft_host_test fft_host_test.c -lm
+ *
+ * USAGE
+ *   ./fft_host_test
+ *   exits with 0 if every check passed, 1 otherwise
+ */
+
+// The FFT code of the demo, without its display and hardware code
+#define FFT_HOST
+#include "fft_new.c"
+
+// Lowest SNR (dB) FFTreal may have against the DFT
+#define MIN_SNR_DB 60.0
+// How much worse (dB) than FFTradix2 FFTreal may be
+#define SNR_SLACK_DB 1.0
+// How much worse (dB) block floating point may be. At full scale it ends
+// up scaling like the fixed version, and the two differ only in where the
+// rounding errors land (a few hundredths of a dB either way).
+#define BLOCK_SLACK_DB 0.1
+// Most pitch error (cents) find_peaks may make, at 1024 and 256 points.
+// At 256 points the lowest tones are only 2 or 3 bins (39 Hz) up, where
+// the window's image at negative frequency tilts the parabola: a few
+// hundredths of a bin, but up to 20 cents at 80-130 Hz. Below
+// PEAK_MIN_FIFTH_256 Hz a fifth is within a couple of bins of its root,
+// too close to pick apart, so the fifth isn't checked there.
+#define MAX_CENTS_1024 5.0
+#define MAX_CENTS_256 20.0
+#define PEAK_MIN_FIFTH_256 300.0
+// Input levels for the block floating point test, relative to full scale
+#define LEVELS 4
+const double levels[LEVELS] = {1.0, 1.0/4, 1.0/16, 1.0/64} ;
+
+// Spectra (bins 0 to NUM_SAMPLES/2) and windowed input of a test
+double ref_re[NUM_SAMPLES/2 + 1], ref_im[NUM_SAMPLES/2 + 1] ;
+fix15 input[NUM_SAMPLES] ;
+
+int failures = 0 ;
+
+// Radix-2 FFT from fft.c, for comparison. Complex input of NUM_SAMPLES
+// points, scaled by 1/N.
+void FFTradix2(fix15 fr[], fix15 fi[]) {
+    
+    unsigned short m;   // one of the indices being swapped
+    unsigned short mr ; // the other index being swapped (r for reversed)
+    fix15 tr, ti ; // for temporary storage while swapping, and during iteration
+    
+    int i, j ; // indices being combined in Danielson-Lanczos part of the algorithm
+    int L ;    // length of the FFT's being combined
+    int k ;    // used for looking up trig values from sine table
+    
+    int istep ; // length of the FFT which results from combining two FFT's
+    
+    fix15 wr, wi ; // trigonometric values from lookup table
+    fix15 qr, qi ; // temporary variables used during DL part of the algorithm
+    
+    //////////////////////////////////////////////////////////////////////////
+    ////////////////////////// BIT REVERSAL //////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    // Bit reversal code below based on that found here: 
+    // https://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
+    for (m=1; m<NUM_SAMPLES_M_1; m++) {
+        // swap odd and even bits
+        mr = ((m >> 1) & 0x5555) | ((m & 0x5555) << 1);
+        // swap consecutive pairs
+        mr = ((mr >> 2) & 0x3333) | ((mr & 0x3333) << 2);
+        // swap nibbles ... 
+        mr = ((mr >> 4) & 0x0F0F) | ((mr & 0x0F0F) << 4);
+        // swap bytes
+        mr = ((mr >> 8) & 0x00FF) | ((mr & 0x00FF) << 8);
+        // shift down mr
+        mr >>= SHIFT_AMOUNT ;
+        // don't swap that which has already been swapped
+        if (mr<=m) continue ;
+        // swap the bit-reveresed indices
+        tr = fr[m] ;
+        fr[m] = fr[mr] ;
+        fr[mr] = tr ;
+        ti = fi[m] ;
+        fi[m] = fi[mr] ;
+        fi[mr] = ti ;
+    }
+    //////////////////////////////////////////////////////////////////////////
+    ////////////////////////// Danielson-Lanczos //////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    // Adapted from code by:
+    // Tom Roberts 11/8/89 and Malcolm Slaney 12/15/94 malcolm@interval.com
+    // Length of the FFT's being combined (starts at 1)
+    L = 1 ;
+    // Log2 of number of samples, minus 1
+    k = LOG2_NUM_SAMPLES - 1 ;
+    // While the length of the FFT's being combined is less than the number 
+    // of gathered samples . . .
+    while (L < NUM_SAMPLES) {
+        // Determine the length of the FFT which will result from combining two FFT's
+        istep = L<<1 ;
+        // For each element in the FFT's that are being combined . . .
+        for (m=0; m<L; ++m) { 
+            // Lookup the trig values for that element
+            j = m << k ;                         // index of the sine table
+            wr =  Sinewave[j + NUM_SAMPLES/4] ; // cos(2pi m/N)
+            wi = -Sinewave[j] ;                 // sin(2pi m/N)
+            wr >>= 1 ;                          // divide by two
+            wi >>= 1 ;                          // divide by two
+            // i gets the index of one of the FFT elements being combined
+            for (i=m; i<NUM_SAMPLES; i+=istep) {
+                // j gets the index of the FFT element being combined with i
+                j = i + L ;
+                // compute the trig terms (bottom half of the above matrix)
+                tr = multfix15(wr, fr[j]) - multfix15(wi, fi[j]) ;
+                ti = multfix15(wr, fi[j]) + multfix15(wi, fr[j]) ;
+                // divide ith index elements by two (top half of above matrix)
+                qr = fr[i]>>1 ;
+                qi = fi[i]>>1 ;
+                // compute the new values at each index
+                fr[j] = qr - tr ;
+                fi[j] = qi - ti ;
+                fr[i] = qr + tr ;
+                fi[i] = qi + ti ;
+            }    
+        }
+        --k ;
+        L = istep ;
+    }
+}
+
+// Same tables as main() in fft_new.c
+void tables_init() {
+    int ii ;
+    for (ii = 0; ii < NUM_SAMPLES; ii++) {
+        Sinewave[ii] = float2fix15(sin(6.283 * ((float) ii) / (float)NUM_SAMPLES));
+        window[ii] = float2fix15(0.5 * (1.0 - cos(6.283 * ((float) ii) / ((float)NUM_SAMPLES))));
+    }
+    FFTinit() ;
+}
+
+// Deterministic noise in [-0.5, 0.5)
+unsigned int noise_state ;
+double noise() {
+    noise_state = noise_state * 1103515245u + 12345u ;
+    return ((noise_state >> 8) & 0xffff) / 65536.0 - 0.5 ;
+}
+
+// Test signals: 8-bit ADC codes around ADC_MIDSCALE, 10 kHz sample rate.
+// amp scales the signal (1 = as loud as it gets without clipping).
+#define SIGNAL_TONE     0   // one tone between bins
+#define SIGNAL_CHORD    1   // three tones of different levels
+#define SIGNAL_NOISE    2   // white noise
+#define SIGNAL_SQUARE   3   // full swing square wave
+#define SIGNAL_DC       4   // full scale DC, all in bin 0
+#define SIGNAL_NYQUIST  5   // full scale at Fs/2, all in the last bin
+#define SIGNAL_BIN      6   // full scale tone on a bin at every length
+#define SIGNALS         7
+#define SIGNALS_STRESS  SIGNAL_SQUARE   // first of the stress inputs
+// Stress inputs are ADC codes minus ADC_MIDSCALE shifted up by this, so
+// that they reach 2^27 (8-bit samples times the Hann window stay below 2^22)
+#define STRESS_SHIFT 20
+const char *signal_names[SIGNALS] = {"tone", "chord", "noise", "square", "dc", "nyq", "bin"} ;
+
+int signal_sample(int signal, int i, double amp) {
+    double v ;
+    switch (signal) {
+        case SIGNAL_TONE:
+            v = 127 * sin(6.283185307179586 * 440.3 * i / Fs) ;
+            break ;
+        case SIGNAL_CHORD:
+            v = 70 * sin(6.283185307179586 * 261.6 * i / Fs)
+              + 40 * sin(6.283185307179586 * 329.6 * i / Fs + 1.0)
+              + 15 * sin(6.283185307179586 * 2093.0 * i / Fs + 2.0) ;
+            break ;
+        case SIGNAL_NOISE:
+            v = 254 * noise() ;
+            break ;
+        case SIGNAL_DC:
+            v = 127 ;
+            break ;
+        case SIGNAL_NYQUIST:
+            v = (i & 1) ? 127 : -128 ;
+            break ;
+        case SIGNAL_BIN:
+            // bin 32 of 256 points (64 of 512, 128 of 1024)
+            v = 127 * sin(6.283185307179586 * i / 8) ;
+            break ;
+        default:
+            v = ((i / 16) & 1) ? 127 : -128 ;
+            break ;
+    }
+    v = ADC_MIDSCALE + amp * v ;
+    if (v < 0) v = 0 ;
+    if (v > 255) v = 255 ;
+    return (int)lround(v) ;
+}
+
+// Window n samples of a signal into input[], the way the demo's FFT thread
+// does (a shorter FFT takes every step'th point of the window)
+void make_input(int signal, int log2_n, double amp) {
+    int n = 1 << log2_n ;
+    int step = NUM_SAMPLES >> log2_n ;
+    int i ;
+    noise_state = 12345 ;
+    for (i=0; i<n; i++) {
+        input[i] = multfix15(int2fix15((signal_sample(signal, i, amp) - ADC_MIDSCALE)), window[i*step]) ;
+    }
+}
+
+// n unwindowed samples of a full scale signal, scaled up to 2^27
+void make_stress_input(int signal, int log2_n) {
+    int n = 1 << log2_n ;
+    int i ;
+    noise_state = 12345 ;
+    for (i=0; i<n; i++) {
+        input[i] = (signal_sample(signal, i, 1.0) - ADC_MIDSCALE) << STRESS_SHIFT ;
+    }
+}
+
+// DFT of input[] in double precision, scaled by 1/N like the FFTs
+void dft(int log2_n) {
+    int n = 1 << log2_n ;
+    int k, i ;
+    double a ;
+    for (k=0; k<=(n>>1); k++) {
+        ref_re[k] = 0 ;
+        ref_im[k] = 0 ;
+        for (i=0; i<n; i++) {
+            a = 6.283185307179586 * (double)((long)k * i % n) / n ;
+            ref_re[k] += input[i] * cos(a) ;
+            ref_im[k] -= input[i] * sin(a) ;
+        }
+        ref_re[k] /= n ;
+        ref_im[k] /= n ;
+    }
+}
+
+// SNR (dB) of the spectrum in fr/fi (bins 0 to N/2) against the DFT
+double snr(int log2_n) {
+    int k ;
+    double sig = 0, err = 0, dr, di ;
+    for (k=0; k<=(1 << (log2_n - 1)); k++) {
+        dr = fr[k] - ref_re[k] ;
+        di = fi[k] - ref_im[k] ;
+        sig += ref_re[k]*ref_re[k] + ref_im[k]*ref_im[k] ;
+        err += dr*dr + di*di ;
+    }
+    return 10 * log10(sig / (err > 0 ? err : 1e-30)) ;
+}
+
+// SNR of FFTreal on input[]
+double snr_real(int log2_n) {
+    int i ;
+    for (i=0; i<(1 << (log2_n - 1)); i++) {
+        fr[i] = input[2*i] ;
+        fi[i] = input[2*i+1] ;
+    }
+    FFTreal(fr, fi, log2_n) ;
+    return snr(log2_n) ;
+}
+
+// SNR of FFTradix2 on input[] (NUM_SAMPLES points only)
+double snr_radix2() {
+    int i ;
+    for (i=0; i<NUM_SAMPLES; i++) {
+        fr[i] = input[i] ;
+        fi[i] = 0 ;
+    }
+    FFTradix2(fr, fi) ;
+    return snr(LOG2_NUM_SAMPLES) ;
+}
+
+// FFTreal against the DFT at 256, 512 and 1024 points, and against
+// FFTradix2 at 1024, with the fixed scaling FFTradix2 has
+void test_accuracy() {
+    int signal, log2_n ;
+    double s_real, s_radix2 ;
+
+    printf("FFTreal (fixed scaling) against a double DFT, SNR in dB\n") ;
+    fft_block_float = false ;
+    for (signal=0; signal<SIGNALS; signal++) {
+        printf("  %-6s", signal_names[signal]) ;
+        for (log2_n=8; log2_n<=LOG2_NUM_SAMPLES; log2_n++) {
+            make_input(signal, log2_n, 1.0) ;
+            dft(log2_n) ;
+            s_real = snr_real(log2_n) ;
+            printf("  %4d: %5.1f", 1 << log2_n, s_real) ;
+            if (s_real < MIN_SNR_DB) {
+                printf(" FAIL") ;
+                failures++ ;
+            }
+        }
+        s_radix2 = snr_radix2() ;
+        printf("  radix-2 %d: %5.1f", NUM_SAMPLES, s_radix2) ;
+        if (s_real < s_radix2 - SNR_SLACK_DB) {
+            printf(" FAIL (FFTreal worse)") ;
+            failures++ ;
+        }
+        printf("\n") ;
+    }
+    fft_block_float = true ;
+}
+
+// Block floating point against fixed scaling, at every level and length
+void test_block_float() {
+    int signal, level, log2_n ;
+    double s_fixed, s_block ;
+
+    printf("Block floating point against fixed scaling, SNR in dB (fixed/block)\n") ;
+    for (signal=0; signal<SIGNALS; signal++) {
+        for (level=0; level<LEVELS; level++) {
+            printf("  %-6s %4.0f dB", signal_names[signal], 20 * log10(levels[level])) ;
+            for (log2_n=8; log2_n<=LOG2_NUM_SAMPLES; log2_n++) {
+                make_input(signal, log2_n, levels[level]) ;
+                dft(log2_n) ;
+                fft_block_float = false ;
+                s_fixed = snr_real(log2_n) ;
+                fft_block_float = true ;
+                s_block = snr_real(log2_n) ;
+                printf("  %4d: %5.1f/%5.1f", 1 << log2_n, s_fixed, s_block) ;
+                if (s_block < s_fixed - BLOCK_SLACK_DB) {
+                    printf(" FAIL (worse)") ;
+                    failures++ ;
+                }
+            }
+            printf("\n") ;
+        }
+    }
+
+    printf("Stress inputs at 2^27, unwindowed, SNR in dB (fixed/block)\n") ;
+    for (signal=SIGNALS_STRESS; signal<SIGNALS; signal++) {
+        printf("  %-6s", signal_names[signal]) ;
+        for (log2_n=8; log2_n<=LOG2_NUM_SAMPLES; log2_n++) {
+            make_stress_input(signal, log2_n) ;
+            dft(log2_n) ;
+            fft_block_float = false ;
+            s_fixed = snr_real(log2_n) ;
+            fft_block_float = true ;
+            s_block = snr_real(log2_n) ;
+            printf("  %4d: %5.1f/%5.1f", 1 << log2_n, s_fixed, s_block) ;
+            if (s_fixed < MIN_SNR_DB || s_block < MIN_SNR_DB) {
+                printf(" FAIL (overflow)") ;
+                failures++ ;
+            }
+        }
+        printf("\n") ;
+    }
+}
+
+// Window n samples of a tone at f Hz (and, if fifth, a quieter one at
+// 1.5 f) with a little noise, then take their magnitudes the way the demo
+// does: FFTreal, then alpha max plus beta min into fr
+void tone_spectrum(int log2_n, double f, int fifth) {
+    int n = 1 << log2_n ;
+    int step = NUM_SAMPLES >> log2_n ;
+    int i, code ;
+    double v ;
+    for (i=0; i<n; i++) {
+        v = ADC_MIDSCALE + 60 * sin(6.283185307179586 * f * i / Fs + f)
+          + (fifth ? 30 * sin(6.283185307179586 * 1.5 * f * i / Fs) : 0) + 8 * noise() ;
+        code = (int)lround(v) ;
+        input[i] = multfix15(int2fix15((code - ADC_MIDSCALE)), window[i*step]) ;
+    }
+    for (i=0; i<(n>>1); i++) {
+        fr[i] = input[2*i] ;
+        fi[i] = input[2*i+1] ;
+    }
+    FFTreal(fr, fi, log2_n) ;
+    for (i=0; i<(n>>1); i++) {
+        fr[i] = abs(fr[i]) ;
+        fi[i] = abs(fi[i]) ;
+        fr[i] = max(fr[i], fi[i]) + multfix15(min(fr[i], fi[i]), zero_point_4) ;
+    }
+}
+
+// Pitch error (cents) of the loudest peak of every tone, and of the second
+// peak when a fifth is added, interpolated and as the nearest bin
+void test_peaks() {
+    struct note_mag_freq_array peaks[2] ;
+    int log2_n, fifth, n, first, i, best, tones ;
+    double f, want, cents, sum, worst, bin_sum, bin_worst, limit ;
+
+    printf("Pitch from find_peaks against the nearest bin, 80 Hz to 2 kHz, cents\n") ;
+    noise_state = 12345 ;
+    for (fifth=0; fifth<2; fifth++) {
+        for (log2_n=LOG2_NUM_SAMPLES; log2_n>=8; log2_n-=2) {
+            n = 1 << log2_n ;
+            first = (int)(PEAK_MIN_FREQ * n / Fs) + 1 ;
+            limit = (log2_n == LOG2_NUM_SAMPLES) ? MAX_CENTS_1024 : MAX_CENTS_256 ;
+            sum = worst = bin_sum = bin_worst = 0 ;
+            tones = 0 ;
+            for (f=80; f<2000; f*=1.0137) {
+                if (fifth && log2_n < LOG2_NUM_SAMPLES && f < PEAK_MIN_FIFTH_256) continue ;
+                tone_spectrum(log2_n, f, fifth) ;
+                find_peaks(fr, first, (n>>1) - 2, log2_n, peaks, 2) ;
+                want = fifth ? 1.5 * f : f ;
+                cents = fabs(1200 * log2(fix2float15(peaks[fifth].freq) / want)) ;
+                sum += cents ;
+                if (cents > worst) worst = cents ;
+                if (!fifth) {
+                    best = first ;
+                    for (i=first; i<=(n>>1) - 2; i++) {
+                        if (fr[i] > fr[best]) best = i ;
+                    }
+                    cents = fabs(1200 * log2(best * (Fs / n) / want)) ;
+                    bin_sum += cents ;
+                    if (cents > bin_worst) bin_worst = cents ;
+                }
+                tones++ ;
+            }
+            printf("  %-6s %4d: mean %4.1f max %4.1f", fifth ? "fifth" : "tone", n, sum / tones, worst) ;
+            if (!fifth) {
+                printf("  (nearest bin: mean %5.1f max %5.1f)", bin_sum / tones, bin_worst) ;
+            }
+            if (worst > limit) {
+                printf(" FAIL") ;
+                failures++ ;
+            }
+            printf("\n") ;
+        }
+    }
+}
+
+int main() {
+    tables_init() ;
+    test_accuracy() ;
+    test_block_float() ;
+    test_peaks() ;
+    printf(failures ? "%d checks FAILED\n" : "all checks passed\n", failures) ;
+    return failures ? 1 : 0 ;
+}
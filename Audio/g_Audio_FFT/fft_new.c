@@ -6,6 +6,11 @@
  * 
  * Core 0 computes and displays the FFT. Core 1 blinks the LED.
  *
+ * With SPECTROGRAM=1 the display is a waterfall instead of bars: each FFT
+ * becomes one row of colors, newest at the top, and the rows below scroll
+ * down. This needs vga_graphics.c built with VGA_SCROLL=1 too, e.g.
+ * target_compile_definitions(fft PRIVATE SPECTROGRAM=1 VGA_SCROLL=1)
+ *
  * HARDWARE CONNECTIONS
  *  - GPIO 16 ---> VGA Hsync
  *  - GPIO 17 ---> VGA Vsync
@@ -18,18 +23,29 @@
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
  *  - DMA channels 0, 1, 2, and 3
+ *  - DMA_IRQ_1 (ADC capture blocks)
  *  - ADC channel 0
  *  - 153.6 kBytes of RAM (for pixel color data)
  *
+ * HOST TEST
+ *  - fft_host_test.c builds the FFT code from this file on a PC (with
+ *    FFT_HOST defined, which leaves out the display and hardware code)
+ *
  */
 
+#ifndef FFT_HOST
 // Include VGA graphics library
 #include "vga_graphics.h"
+#endif
 // Include standard libraries
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#ifdef FFT_HOST
+#include <stdint.h>
+#include <stdbool.h>
+#else
 // Include Pico libraries
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
@@ -40,6 +56,7 @@
 #include "hardware/irq.h"
 // Include protothreads
 #include "pt_cornell_rp2040_v1.h"
+#endif
 
 // Define the LED pin
 #define LED     25
@@ -70,10 +87,48 @@ typedef signed int fix15 ;
 #define Fs 10000.0
 // ADC clock rate (unmutable!)
 #define ADCCLK 48000000.0
-
-// DMA channels for sampling ADC (VGA driver uses 0 and 1)
-int sample_chan = 2 ;
-int control_chan = 3 ;
+// Mid-scale of the 8-bit samples. It is taken off before the FFT so that
+// the DC bias doesn't set the FFT's block exponent (only bin 0 changes).
+#define ADC_MIDSCALE 128
+
+// Capture ring for the ADC: twice the FFT length, filled block by block
+// with no gaps between blocks (a power of two, so indices wrap with a mask)
+#define CAPTURE_SAMPLES (2*NUM_SAMPLES)
+// Samples per DMA block (25.6 ms at 10 kHz)
+#define CAPTURE_BLOCK (NUM_SAMPLES/4)
+// Samples between the starts of successive FFT windows. NUM_SAMPLES/2 gives
+// 50% overlap, NUM_SAMPLES/4 gives 75%. A multiple of CAPTURE_BLOCK, at
+// most NUM_SAMPLES.
+#ifndef HOP_SAMPLES
+#define HOP_SAMPLES (NUM_SAMPLES/2)
+#endif
+#if (HOP_SAMPLES % CAPTURE_BLOCK) || (HOP_SAMPLES > NUM_SAMPLES)
+#error "HOP_SAMPLES must be a multiple of CAPTURE_BLOCK, at most NUM_SAMPLES"
+#endif
+
+////////////////////////// Display configuration /////////////////////////////
+// Bars (0) or a scrolling spectrogram (1)
+#ifndef SPECTROGRAM
+#define SPECTROGRAM 0
+#endif
+#if SPECTROGRAM && !VGA_SCROLL
+#error "SPECTROGRAM needs VGA_SCROLL=1 (for both fft_new.c and vga_graphics.c)"
+#endif
+// Rows below the text, where the bars or the spectrogram go
+#define SPECTRUM_TOP 50
+#define SPECTRUM_ROWS 430
+// Spectrogram color for each octave (6 dB) of magnitude, darkest first,
+// from 2^SPECTRO_FLOOR_BIT (below which it is black) up
+#define SPECTRO_FLOOR_BIT 11
+#ifndef FFT_HOST
+const char spectro_colors[8] = {BLACK, BLUE, RED, MAGENTA, GREEN, CYAN, YELLOW, WHITE} ;
+#endif
+
+// DMA channels for sampling ADC (VGA driver uses 0 and 1). They take turns
+// filling the blocks of the capture ring, each chained to the other, so one
+// is always running while the other is pointed at its next block.
+int sample_chan_a = 2 ;
+int sample_chan_b = 3 ;
 
 // Max and min macros
 #define max(a,b) ((a>b)?a:b)
@@ -82,8 +137,21 @@ int control_chan = 3 ;
 // 0.4 in fixed point (used for alpha max plus beta min)
 fix15 zero_point_4 = float2fix15(0.4) ;
 
-// Here's where we'll have the DMA channel put ADC samples
-uint8_t sample_array[NUM_SAMPLES] ;
+// A peak of the spectrum: its magnitude, and its frequency in Hz
+struct note_mag_freq_array {
+    fix15 mag ;
+    fix15 freq ;
+} ;
+// Peaks below this frequency (Hz) are ignored, which keeps DC and mains
+// hum out of the peak picking
+#define PEAK_MIN_FREQ 40.0
+
+// Here's where we'll have the DMA channels put ADC samples
+uint8_t sample_array[CAPTURE_SAMPLES] ;
+// Samples captured since the start, counted by the DMA interrupt
+volatile unsigned int capture_count = 0 ;
+// Windows skipped because the FFT fell more than a hop behind
+unsigned int capture_skipped = 0 ;
 // And here's where we'll copy those samples for FFT calculation
 fix15 fr[NUM_SAMPLES] ;
 fix15 fi[NUM_SAMPLES] ;
@@ -93,32 +161,46 @@ fix15 Sinewave[NUM_SAMPLES];
 // Hann window table for FFT calculation
 fix15 window[NUM_SAMPLES]; 
 
-// Pointer to address of start of sample buffer
-uint8_t * sample_address_pointer = &sample_array[0] ;
+// Bit reversal swap list for FFTfix: the pairs of indices to exchange for
+// one FFT length, two entries per pair, built the first time that length runs
+unsigned short fft_swaps[NUM_SAMPLES] ;
+int fft_n_swaps = 0 ;       // entries in fft_swaps
+int fft_swaps_log2_n = 0 ;  // log2 of the length the list was built for
+
+// Twiddles of the radix-4 stages. A stage combining FFT's of length L needs
+// W^m, W^2m and W^3m (W = exp(-2pi i/4L), real and imaginary parts) for
+// m = 1..L-1. They are stored at entries L..2L-2, in the order the stage
+// reads them, so each stage walks its own stretch of the table.
+fix15 fft_twiddle[NUM_SAMPLES>>1][6] ;
+
+// Block floating point: FFTfix halves the data only when a stage could
+// overflow, instead of at every stage, so quiet input keeps its precision
+bool fft_block_float = true ;
+
+// Fill the twiddle table for FFTfix. Call once before the first FFT.
+void FFTinit() {
+    int L, m, p ;
+    double a ;
+    for (L=2; L<=(NUM_SAMPLES>>2); L<<=1) {
+        for (m=1; m<L; m++) {
+            for (p=1; p<=3; p++) {
+                a = 6.283185307179586 * p * m / (4 * L) ;
+                fft_twiddle[L-1+m][2*p-2] =  float2fix15(cos(a)) ;
+                fft_twiddle[L-1+m][2*p-1] = -float2fix15(sin(a)) ;
+            }
+        }
+    }
+}
 
-// Peforms an in-place FFT. For more information about how this
-// algorithm works, please see https://vanhunteradams.com/FFT/FFT.html
-void FFTfix(fix15 fr[], fix15 fi[]) {
-    
+// List the index pairs the bit reversal swaps for a 2^log2_n point FFT
+void FFTswaps(int log2_n) {
     unsigned short m;   // one of the indices being swapped
     unsigned short mr ; // the other index being swapped (r for reversed)
-    fix15 tr, ti ; // for temporary storage while swapping, and during iteration
-    
-    int i, j ; // indices being combined in Danielson-Lanczos part of the algorithm
-    int L ;    // length of the FFT's being combined
-    int k ;    // used for looking up trig values from sine table
-    
-    int istep ; // length of the FFT which results from combining two FFT's
-    
-    fix15 wr, wi ; // trigonometric values from lookup table
-    fix15 qr, qi ; // temporary variables used during DL part of the algorithm
-    
-    //////////////////////////////////////////////////////////////////////////
-    ////////////////////////// BIT REVERSAL //////////////////////////////////
-    //////////////////////////////////////////////////////////////////////////
+
+    fft_n_swaps = 0 ;
     // Bit reversal code below based on that found here: 
     // https://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
-    for (m=1; m<NUM_SAMPLES_M_1; m++) {
+    for (m=1; m<(1<<log2_n)-1; m++) {
         // swap odd and even bits
         mr = ((m >> 1) & 0x5555) | ((m & 0x5555) << 1);
         // swap consecutive pairs
@@ -128,59 +210,301 @@ void FFTfix(fix15 fr[], fix15 fi[]) {
         // swap bytes
         mr = ((mr >> 8) & 0x00FF) | ((mr & 0x00FF) << 8);
         // shift down mr
-        mr >>= SHIFT_AMOUNT ;
+        mr >>= SHIFT_AMOUNT + LOG2_NUM_SAMPLES - log2_n ;
         // don't swap that which has already been swapped
         if (mr<=m) continue ;
+        fft_swaps[fft_n_swaps++] = m ;
+        fft_swaps[fft_n_swaps++] = mr ;
+    }
+    fft_swaps_log2_n = log2_n ;
+}
+
+// Magnitude for the block peak: x, or -x - 1 when negative, which has the
+// same top bit except at -2^k (one bit lower, and FFTshift allows for it)
+#define FFTpeak(x) ((x) ^ ((x) >> 31))
+
+// Last step of a radix-4 butterfly. The quarters at i, i+L, i+2L and i+3L
+// hold the FFT's of the samples 0, 2, 1 and 3 mod 4, here already
+// multiplied by their twiddles (a, b, c, d). Combine them into the four
+// outputs, divided by 2^shift (4 in fixed scaling, like two radix-2
+// stages). In block floating point returns the OR of the outputs'
+// magnitudes (see FFTpeak), for the next stage.
+static inline fix15 FFTradix4(fix15 fr[], fix15 fi[], int i, int L, int shift, bool block,
+                              fix15 ar, fix15 ai, fix15 br, fix15 bi,
+                              fix15 cr, fix15 ci, fix15 dr, fix15 di) {
+    fix15 sr = ar + br, si = ai + bi ;  // even samples, first half
+    fix15 tr = ar - br, ti = ai - bi ;  // even samples, second half
+    fix15 ur = cr + dr, ui = ci + di ;  // odd samples, first half
+    fix15 vr = cr - dr, vi = ci - di ;  // odd samples, second half
+    fix15 peak ;
+    // (the inputs' names are reused for the outputs)
+    ar = (sr + ur) >> shift ;
+    ai = (si + ui) >> shift ;
+    cr = (sr - ur) >> shift ;
+    ci = (si - ui) >> shift ;
+    // the second half of the odd samples turns by -i, then by +i
+    br = (tr + vi) >> shift ;
+    bi = (ti - vr) >> shift ;
+    dr = (tr - vi) >> shift ;
+    di = (ti + vr) >> shift ;
+    fr[i] = ar ;       fi[i] = ai ;
+    fr[i + L] = br ;   fi[i + L] = bi ;
+    fr[i + 2*L] = cr ; fi[i + 2*L] = ci ;
+    fr[i + 3*L] = dr ; fi[i + 3*L] = di ;
+    if (!block) return 0 ;
+    peak = FFTpeak(ar) | FFTpeak(ai) | FFTpeak(br) | FFTpeak(bi) ;
+    return peak | FFTpeak(cr) | FFTpeak(ci) | FFTpeak(dr) | FFTpeak(di) ;
+}
+
+// Halvings a block floating point stage needs so that its output stays
+// below 2^28, given the OR of its input magnitudes and the highest input
+// bit that cannot overflow (24 for a radix-4 stage, which can grow the peak
+// by 4 sqrt(2), and 26 for a radix-2 stage, which can double it). A peak
+// with top bit b is below 2^(b+1), or equal to it from FFTpeak, which the
+// half-bit margin of the 4 sqrt(2) bound and the 2^31 limit both cover.
+static inline int FFTshift(fix15 peak, int top) {
+    int bit = peak ? 31 - __builtin_clz(peak) : 0 ;
+    return bit > top ? bit - top : 0 ;
+}
+
+// Peforms an in-place FFT of 2^log2_n points (at most NUM_SAMPLES). For more
+// information about how this algorithm works, please see
+// https://vanhunteradams.com/FFT/FFT.html
+// The bit reversal runs from a precomputed swap list, and the stages are
+// radix 4 (after one radix-2 stage for odd powers of two) with twiddles
+// from fft_twiddle. Input must stay below 2^28 in magnitude (8-bit samples
+// are below 2^23). Returns the block exponent: the number of halvings, so
+// that the result is the DFT divided by 2^exponent.
+// In fixed scaling each stage halves the data per factor of 2, as the
+// radix-2 version did, so the result is scaled by 1/N (the exponent is
+// log2_n). In block floating point (fft_block_float) each stage checks the
+// peak of its input and halves only as far as it needs to stay below 2^28.
+int FFTfix(fix15 fr[], fix15 fi[], int log2_n) {
+    
+    int n = 1 << log2_n ; // number of points
+    int s ;               // index into the swap list
+    fix15 tr, ti ;        // for temporary storage while swapping, and during iteration
+    
+    int i, m ;  // element and twiddle index of the butterflies
+    int L ;     // length of the FFT's being combined
+    int istep ; // length of the FFT which results from combining them
+    
+    fix15 *w ;          // twiddles of element m
+    fix15 qr, qi ;      // temporary variables for the radix-2 stage
+    fix15 br, bi ;      // quarters times their twiddles
+    fix15 cr, ci ;
+    fix15 dr, di ;
+
+    bool block = fft_block_float ;  // block floating point, for this FFT
+    int shift ;         // halvings in the current stage
+    int exponent = 0 ;  // halvings so far
+    fix15 peak = 0 ;    // OR of the magnitudes going into the current stage
+    
+    //////////////////////////////////////////////////////////////////////////
+    ////////////////////////// BIT REVERSAL //////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    if (log2_n != fft_swaps_log2_n) FFTswaps(log2_n) ;
+    for (s=0; s<fft_n_swaps; s+=2) {
         // swap the bit-reveresed indices
+        m = fft_swaps[s] ;
+        i = fft_swaps[s+1] ;
         tr = fr[m] ;
-        fr[m] = fr[mr] ;
-        fr[mr] = tr ;
+        fr[m] = fr[i] ;
+        fr[i] = tr ;
         ti = fi[m] ;
-        fi[m] = fi[mr] ;
-        fi[mr] = ti ;
+        fi[m] = fi[i] ;
+        fi[i] = ti ;
+    }
+    // The first stage's peak comes from the input. Later ones come from
+    // the stage before, as it writes its output.
+    if (block) {
+        for (i=0; i<n; i++) peak |= FFTpeak(fr[i]) | FFTpeak(fi[i]) ;
     }
     //////////////////////////////////////////////////////////////////////////
     ////////////////////////// Danielson-Lanczos //////////////////////////////
     //////////////////////////////////////////////////////////////////////////
-    // Adapted from code by:
-    // Tom Roberts 11/8/89 and Malcolm Slaney 12/15/94 malcolm@interval.com
     // Length of the FFT's being combined (starts at 1)
     L = 1 ;
-    // Log2 of number of samples, minus 1
-    k = LOG2_NUM_SAMPLES - 1 ;
-    // While the length of the FFT's being combined is less than the number 
-    // of gathered samples . . .
-    while (L < NUM_SAMPLES) {
-        // Determine the length of the FFT which will result from combining two FFT's
-        istep = L<<1 ;
-        // For each element in the FFT's that are being combined . . .
-        for (m=0; m<L; ++m) { 
+    // An odd power of two starts with a radix-2 stage. Its only twiddle is 1.
+    if (log2_n & 1) {
+        shift = block ? FFTshift(peak, 26) : 1 ;
+        peak = 0 ;
+        for (i=0; i<n; i+=2) {
+            qr = fr[i]>>shift ;
+            qi = fi[i]>>shift ;
+            tr = fr[i+1]>>shift ;
+            ti = fi[i+1]>>shift ;
+            fr[i+1] = qr - tr ;
+            fi[i+1] = qi - ti ;
+            fr[i] = qr + tr ;
+            fi[i] = qi + ti ;
+            if (block) peak |= FFTpeak(fr[i]) | FFTpeak(fi[i]) | FFTpeak(fr[i+1]) | FFTpeak(fi[i+1]) ;
+        }
+        exponent += shift ;
+        L = 2 ;
+    }
+    // Radix-4 stages: combine four FFT's of length L into one of length 4L
+    while (L < n) {
+        istep = L<<2 ;
+        shift = block ? FFTshift(peak, 24) : 2 ;
+        peak = 0 ;
+        // Element 0 of each group has no twiddles to multiply by
+        for (i=0; i<n; i+=istep) {
+            peak |= FFTradix4(fr, fi, i, L, shift, block, fr[i], fi[i], fr[i+L], fi[i+L],
+                              fr[i+2*L], fi[i+2*L], fr[i+3*L], fi[i+3*L]) ;
+        }
+        // For each other element in the FFT's that are being combined . . .
+        for (m=1; m<L; m++) {
             // Lookup the trig values for that element
-            j = m << k ;                         // index of the sine table
-            wr =  Sinewave[j + NUM_SAMPLES/4] ; // cos(2pi m/N)
-            wi = -Sinewave[j] ;                 // sin(2pi m/N)
-            wr >>= 1 ;                          // divide by two
-            wi >>= 1 ;                          // divide by two
-            // i gets the index of one of the FFT elements being combined
-            for (i=m; i<NUM_SAMPLES; i+=istep) {
-                // j gets the index of the FFT element being combined with i
-                j = i + L ;
-                // compute the trig terms (bottom half of the above matrix)
-                tr = multfix15(wr, fr[j]) - multfix15(wi, fi[j]) ;
-                ti = multfix15(wr, fi[j]) + multfix15(wi, fr[j]) ;
-                // divide ith index elements by two (top half of above matrix)
-                qr = fr[i]>>1 ;
-                qi = fi[i]>>1 ;
-                // compute the new values at each index
-                fr[j] = qr - tr ;
-                fi[j] = qi - ti ;
-                fr[i] = qr + tr ;
-                fi[i] = qi + ti ;
-            }    
+            w = fft_twiddle[L-1+m] ;
+            for (i=m; i<n; i+=istep) {
+                // quarter 1 times W^2m, quarter 2 times W^m, quarter 3 times W^3m
+                br = multfix15(w[2], fr[i+L]) - multfix15(w[3], fi[i+L]) ;
+                bi = multfix15(w[2], fi[i+L]) + multfix15(w[3], fr[i+L]) ;
+                cr = multfix15(w[0], fr[i+2*L]) - multfix15(w[1], fi[i+2*L]) ;
+                ci = multfix15(w[0], fi[i+2*L]) + multfix15(w[1], fr[i+2*L]) ;
+                dr = multfix15(w[4], fr[i+3*L]) - multfix15(w[5], fi[i+3*L]) ;
+                di = multfix15(w[4], fi[i+3*L]) + multfix15(w[5], fr[i+3*L]) ;
+                peak |= FFTradix4(fr, fi, i, L, shift, block, fr[i], fi[i], br, bi, cr, ci, dr, di) ;
+            }
         }
-        --k ;
+        exponent += shift ;
         L = istep ;
     }
+    return exponent ;
+}
+
+// FFT of N = 2^log2_n real samples (at most NUM_SAMPLES), computed as a
+// complex FFT of half the length. Pass the even samples in fr[0..N/2-1] and
+// the odd samples in fi[0..N/2-1]. Bins 0 to N/2 come back in fr and fi,
+// scaled by 1/N like FFTfix, for about half of FFTfix's butterflies on the
+// zero imaginary part.
+// In block floating point the scaling to 1/N is left to the last butterfly,
+// which rounds, so quiet input only loses bits there.
+void FFTreal(fix15 fr[], fix15 fi[], int log2_n) {
+
+    int k ;         // bin being split out, along with bin N/2 - k
+    int kr ;        // N/2 - k
+    fix15 ar, ai ;  // half-length spectrum at k
+    fix15 br, bi ;  // half-length spectrum at N/2 - k
+    fix15 ur, ui ;  // spectrum of the even samples at k
+    fix15 vr, vi ;  // spectrum of the odd samples at k
+    fix15 wr, wi ;  // trigonometric values from lookup table
+    fix15 tr, ti ;  // odd spectrum times the twiddle
+    int shift ;     // halvings in the last butterfly
+    fix15 round ;   // half of the last butterfly's step, or 0 to truncate
+    int n = 1 << log2_n ;                   // number of points
+    int step = NUM_SAMPLES >> log2_n ;      // Sinewave entries per bin
+
+    // Transform the even/odd pairs as N/2 complex samples
+    shift = log2_n - FFTfix(fr, fi, log2_n - 1) ;
+    // The last butterfly halves once, plus whatever FFTfix skipped. If it
+    // halved more than fixed scaling would have, undo the difference now
+    // (the spectrum at 1/(N/2) is no larger than the input, so this fits).
+    if (shift < 1) {
+        for (k=0; k<(n>>1); k++) {
+            fr[k] <<= 1 - shift ;
+            fi[k] <<= 1 - shift ;
+        }
+        shift = 1 ;
+    }
+    round = fft_block_float ? 1 << (shift - 1) : 0 ;
+
+    // The real parts of that spectrum hold the even samples' spectrum and
+    // the imaginary parts the odd samples'. Split them using the symmetry of
+    // real input, then combine them with one more butterfly (which also
+    // halves, like each stage of FFTfix).
+    // Bin 0 gives DC and Nyquist
+    ar = fr[0] ;
+    ai = fi[0] ;
+    fr[0] = (ar + ai + round) >> shift ;
+    fi[0] = 0 ;
+    fr[n>>1] = (ar - ai + round) >> shift ;
+    fi[n>>1] = 0 ;
+    for (k=1; k<=(n>>2); k++) {
+        kr = (n>>1) - k ;
+        ar = fr[k] ;
+        ai = fi[k] ;
+        br = fr[kr] ;
+        bi = fi[kr] ;
+        // even and odd spectra
+        ur = (ar + br) >> 1 ;
+        ui = (ai - bi) >> 1 ;
+        vr = (ai + bi) >> 1 ;
+        vi = (br - ar) >> 1 ;
+        // twiddle the odd spectrum by exp(-2pi k/N)
+        wr =  Sinewave[k*step + NUM_SAMPLES/4] ; // cos(2pi k/N)
+        wi = -Sinewave[k*step] ;                 // sin(2pi k/N)
+        tr = multfix15(wr, vr) - multfix15(wi, vi) ;
+        ti = multfix15(wr, vi) + multfix15(wi, vr) ;
+        // bin k, and bin N/2 - k as its mirror image
+        fr[k] = (ur + tr + round) >> shift ;
+        fi[k] = (ui + ti + round) >> shift ;
+        fr[kr] = (ur - tr + round) >> shift ;
+        fi[kr] = (ti - ui + round) >> shift ;
+    }
+}
+
+// Find the k loudest local maxima of the magnitudes mag[first..last] (a bin
+// louder than the one below it and at least as loud as the one above) and
+// put them in peaks[], loudest first. The frequency of each comes from a
+// parabola through the log magnitudes of its bin and the two neighbours
+// (Gaussian interpolation), which lands well within a tenth of a bin of the
+// true frequency, rather than the nearest bin of a 2^log2_n point FFT.
+// Entries with no peak are zeroed. Returns the number of peaks found.
+int find_peaks(fix15 mag[], int first, int last, int log2_n,
+               struct note_mag_freq_array peaks[], int k) {
+    int found = 0 ;
+    int i, j ;
+    float la, lb, lc ;              // log magnitudes around a peak
+    float den ;                     // curvature of the parabola
+    float delta ;                   // offset of its top from the bin (bins)
+
+    for (j=0; j<k; j++) {
+        peaks[j].mag = 0 ;
+        peaks[j].freq = 0 ;
+    }
+    // Insert each local maximum louder than the quietest kept one, keeping
+    // its bin in freq for now
+    for (i=first; i<=last; i++) {
+        if (mag[i] <= mag[i-1] || mag[i] < mag[i+1] || mag[i] <= peaks[k-1].mag) continue ;
+        for (j=k-1; j>0 && peaks[j-1].mag < mag[i]; j--) {
+            peaks[j] = peaks[j-1] ;
+        }
+        peaks[j].mag = mag[i] ;
+        peaks[j].freq = i ;
+        if (found < k) found++ ;
+    }
+    // Interpolate, and turn bins into Hz
+    for (j=0; j<found; j++) {
+        i = peaks[j].freq ;
+        la = logf((float)max(mag[i-1], 1)) ;
+        lb = logf((float)mag[i]) ;
+        lc = logf((float)max(mag[i+1], 1)) ;
+        den = la - 2*lb + lc ;
+        delta = (den < 0) ? 0.5f * (la - lc) / den : 0 ;
+        peaks[j].freq = float2fix15((i + delta) * (Fs / (1 << log2_n))) ;
+    }
+    return found ;
+}
+
+#ifndef FFT_HOST
+
+// A capture block is full: count it, and point the channel that filled it at
+// its next block, two on (the other channel is filling the one between).
+// The transfer count reloads when the other channel chains to it.
+void captureHandler() {
+    int ch[2] = {sample_chan_a, sample_chan_b} ;
+    uint8_t * next ;
+    for (int k=0; k<2; k++) {
+        if (dma_hw->ints1 & (1u << ch[k])) {
+            dma_hw->ints1 = 1u << ch[k] ;
+            capture_count += CAPTURE_BLOCK ;
+            next = (uint8_t *)dma_hw->ch[ch[k]].write_addr + CAPTURE_BLOCK ;
+            if (next >= sample_array + CAPTURE_SAMPLES) next -= CAPTURE_SAMPLES ;
+            dma_channel_set_write_addr(ch[k], next, false) ;
+        }
+    }
 }
 
 // Runs on core 0
@@ -189,8 +513,8 @@ static PT_THREAD (protothread_fft(struct pt *pt))
     // Indicate beginning of thread
     PT_BEGIN(pt) ;
     printf("Starting capture\n") ;
-    // Start the ADC channel
-    dma_start_channel_mask((1u << sample_chan)) ;
+    // Start the first ADC channel (the second follows by chaining)
+    dma_start_channel_mask((1u << sample_chan_a)) ;
     // Start the ADC
     adc_run(true) ;
 
@@ -199,8 +523,15 @@ static PT_THREAD (protothread_fft(struct pt *pt))
     static float max_freqency ;     // holds max frequency
     static int i ;                  // incrementing loop variable
 
-    static fix15 max_fr ;           // temporary variable for max freq calculation
-    static int max_fr_dex ;         // index of max frequency
+    static struct note_mag_freq_array loudest ;    // loudest peak
+
+    static unsigned int analyzed = 0 ;  // capture_count at the end of the last window
+    static unsigned int now ;           // capture_count at the end of this window
+    static unsigned int start ;         // ring index of this window's first sample
+#if SPECTROGRAM
+    static int row = 0 ;                // spectrogram framebuffer row of the newest frame
+    static int level ;                  // octave of a bin's magnitude
+#endif
 
     // Write some text to VGA
     setTextColor(WHITE) ;
@@ -222,25 +553,29 @@ static PT_THREAD (protothread_fft(struct pt *pt))
 
 
     while(1) {
-        // Wait for NUM_SAMPLES samples to be gathered
-        // Measure wait time with timer. THIS IS BLOCKING
-        dma_channel_wait_for_finish_blocking(sample_chan);
-
-        // Copy/window elements into a fixed-point array
-        for (i=0; i<NUM_SAMPLES; i++) {
-            fr[i] = multfix15(int2fix15((int)sample_array[i]), window[i]) ;
-            fi[i] = (fix15) 0 ;
+        // Wait for a hop's worth of new samples. The DMA keeps filling
+        // the ring meanwhile, so none are lost however long the last
+        // frame took.
+        PT_YIELD_UNTIL(pt, capture_count >= NUM_SAMPLES &&
+                           capture_count - analyzed >= HOP_SAMPLES) ;
+        // The window always ends at the newest block. If more than a hop
+        // has gone by, the windows in between are skipped.
+        now = capture_count ;
+        if (analyzed && now - analyzed >= 2*HOP_SAMPLES) {
+            capture_skipped += (now - analyzed)/HOP_SAMPLES - 1 ;
+        }
+        analyzed = now ;
+        start = (now - NUM_SAMPLES) & (CAPTURE_SAMPLES - 1) ;
+
+        // Copy/window elements into a fixed-point array, even samples to
+        // fr and odd samples to fi for the real FFT
+        for (i=0; i<(NUM_SAMPLES>>1); i++) {
+            fr[i] = multfix15(int2fix15(((int)sample_array[(start + 2*i) & (CAPTURE_SAMPLES - 1)] - ADC_MIDSCALE)), window[2*i]) ;
+            fi[i] = multfix15(int2fix15(((int)sample_array[(start + 2*i + 1) & (CAPTURE_SAMPLES - 1)] - ADC_MIDSCALE)), window[2*i+1]) ;
         }
-
-        // Zero max frequency and max frequency index
-        max_fr = 0 ;
-        max_fr_dex = 0 ;
-
-        // Restart the sample channel, now that we have our copy of the samples
-        dma_channel_start(control_chan) ;
 
         // Compute the FFT
-        FFTfix(fr, fi) ;
+        FFTreal(fr, fi, LOG2_NUM_SAMPLES) ;
 
         // Find the magnitudes (alpha max plus beta min)
         for (int i = 0; i < (NUM_SAMPLES>>1); i++) {  
@@ -250,15 +585,11 @@ static PT_THREAD (protothread_fft(struct pt *pt))
             // reuse fr to hold magnitude
             fr[i] = max(fr[i], fi[i]) + 
                     multfix15(min(fr[i], fi[i]), zero_point_4); 
-
-            // Keep track of maximum
-            if (fr[i] > max_fr && i>4) {
-                max_fr = fr[i] ;
-                max_fr_dex = i ;
-            }
         }
-        // Compute max frequency in Hz
-        max_freqency = max_fr_dex * (Fs/NUM_SAMPLES) ;
+        // Frequency of the loudest peak in Hz, interpolated between bins
+        find_peaks(fr, (int)(PEAK_MIN_FREQ * NUM_SAMPLES / Fs) + 1, (NUM_SAMPLES>>1) - 2,
+                   LOG2_NUM_SAMPLES, &loudest, 1) ;
+        max_freqency = fix2float15(loudest.freq) ;
 
         // Display on VGA
         fillRect(250, 20, 176, 30, BLACK); // red box
@@ -267,12 +598,26 @@ static PT_THREAD (protothread_fft(struct pt *pt))
         setTextSize(2) ;
         writeString(freqtext) ;
 
+#if SPECTROGRAM
+        // Draw this frame as one row, at the framebuffer row just above the
+        // last one (wrapping), and rotate the band so that it shows on top.
+        // The older rows move down a line without being redrawn.
+        row = row ? row - 1 : SPECTRUM_ROWS - 1 ;
+        for (int i=5; i<(NUM_SAMPLES>>1); i++) {
+            // log2 of the magnitude, from its top bit
+            level = fr[i] ? 31 - __builtin_clz(fr[i]) - SPECTRO_FLOOR_BIT : 0 ;
+            level = level < 0 ? 0 : (level > 7 ? 7 : level) ;
+            drawPixel(59+i, SPECTRUM_TOP + row, spectro_colors[level]) ;
+        }
+        setScroll(SPECTRUM_TOP, SPECTRUM_ROWS, row) ;
+#else
         // Update the FFT display
         for (int i=5; i<(NUM_SAMPLES>>1); i++) {
-            drawVLine(59+i, 50, 429, BLACK);
+            drawVLine(59+i, SPECTRUM_TOP, SPECTRUM_ROWS - 1, BLACK);
             height = fix2int15(multfix15(fr[i], int2fix15(36))) ;
             drawVLine(59+i, 479-height, height, WHITE);
         }
+#endif
 
     }
     PT_END(pt) ;
@@ -348,47 +693,51 @@ int main() {
         Sinewave[ii] = float2fix15(sin(6.283 * ((float) ii) / (float)NUM_SAMPLES));
         window[ii] = float2fix15(0.5 * (1.0 - cos(6.283 * ((float) ii) / ((float)NUM_SAMPLES))));
     }
+    // and the FFT's twiddle table
+    FFTinit() ;
 
     /////////////////////////////////////////////////////////////////////////////////
     // ============================== ADC DMA CONFIGURATION =========================
     /////////////////////////////////////////////////////////////////////////////////
 
     // Channel configurations
-    dma_channel_config c2 = dma_channel_get_default_config(sample_chan);
-    dma_channel_config c3 = dma_channel_get_default_config(control_chan);
+    dma_channel_config c2 = dma_channel_get_default_config(sample_chan_a);
+    dma_channel_config c3 = dma_channel_get_default_config(sample_chan_b);
 
 
-    // ADC SAMPLE CHANNEL
+    // ADC SAMPLE CHANNELS
     // Reading from constant address, writing to incrementing byte addresses
     channel_config_set_transfer_data_size(&c2, DMA_SIZE_8);
     channel_config_set_read_increment(&c2, false);
     channel_config_set_write_increment(&c2, true);
     // Pace transfers based on availability of ADC samples
     channel_config_set_dreq(&c2, DREQ_ADC);
-    // Configure the channel
-    dma_channel_configure(sample_chan,
+    // The second channel is the same, and each starts the other when done
+    c3 = c2 ;
+    channel_config_set_chain_to(&c2, sample_chan_b);
+    channel_config_set_chain_to(&c3, sample_chan_a);
+    // Configure the channels, for the first two blocks of the ring
+    dma_channel_configure(sample_chan_a,
         &c2,            // channel config
         sample_array,   // dst
         &adc_hw->fifo,  // src
-        NUM_SAMPLES,    // transfer count
+        CAPTURE_BLOCK,  // transfer count
         false            // don't start immediately
     );
-
-    // CONTROL CHANNEL
-    channel_config_set_transfer_data_size(&c3, DMA_SIZE_32);      // 32-bit txfers
-    channel_config_set_read_increment(&c3, false);                // no read incrementing
-    channel_config_set_write_increment(&c3, false);               // no write incrementing
-    channel_config_set_chain_to(&c3, sample_chan);                // chain to sample chan
-
-    dma_channel_configure(
-        control_chan,                         // Channel to be configured
-        &c3,                                // The configuration we just created
-        &dma_hw->ch[sample_chan].write_addr,  // Write address (channel 0 read address)
-        &sample_address_pointer,                   // Read address (POINTER TO AN ADDRESS)
-        1,                                  // Number of transfers, in this case each is 4 byte
-        false                               // Don't start immediately.
+    dma_channel_configure(sample_chan_b,
+        &c3,                            // channel config
+        sample_array + CAPTURE_BLOCK,   // dst
+        &adc_hw->fifo,                  // src
+        CAPTURE_BLOCK,                  // transfer count
+        false                           // don't start immediately
     );
 
+    // Interrupt at the end of each block, to count it and re-arm its channel
+    dma_channel_set_irq1_enabled(sample_chan_a, true);
+    dma_channel_set_irq1_enabled(sample_chan_b, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, captureHandler);
+    irq_set_enabled(DMA_IRQ_1, true);
+
     // Launch core 1
     multicore_launch_core1(core1_entry);
 
@@ -397,3 +746,5 @@ int main() {
     pt_schedule_start ;
 
 }
+
+#endif // FFT_HOST
@@ -3,6 +3,7 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
 // Our assembled programs:
 // Each gets the name <pio_filename.pio.h>
 #include "hsync.pio.h"
@@ -26,7 +27,24 @@
 // a pointer to the ADDRESS of this color array.
 // Note that this array is automatically initialized to all 0's (black)
 unsigned char vga_data_array[TXCOUNT];
+#if !VGA_SCROLL
 char * address_pointer = &vga_data_array[0] ;
+#else
+// Bytes per scanline (2 pixels per byte)
+#define LINE_BYTES 320
+// Channel 1 restarts channel 0 at the row address_pointer names, one
+// scanline at a time, so the first two lines are already queued
+char * address_pointer = &vga_data_array[LINE_BYTES] ;
+// Next scanline to queue
+static short scroll_next_line = 2 ;
+// Scroll band (see setScroll), packed in one word so that it changes in
+// one write: y in bits 0-9, h in bits 10-19, offset in bits 20-29
+static volatile unsigned int scroll_request = 0 ;
+// and as latched at the top of the frame being sent
+static short scroll_y = 0, scroll_h = 0, scroll_offset = 0 ;
+
+static void scrollLineHandler(void) ;
+#endif
 
 // Bit masks for drawPixel routine
 #define TOPMASK 0b11000111
@@ -89,6 +107,14 @@ void initVGA() {
     int rgb_chan_0 = 0;
     int rgb_chan_1 = 1;
 
+#if VGA_SCROLL
+    // In scroll mode channel 0 sends one scanline at a time, and
+    // the channel 0 interrupt picks the row for the line after next
+    const uint first_count = LINE_BYTES ;
+#else
+    const uint first_count = TXCOUNT ;
+#endif
+
     // Channel Zero (sends color data to PIO VGA machine)
     dma_channel_config c0 = dma_channel_get_default_config(rgb_chan_0);  // default configs
     channel_config_set_transfer_data_size(&c0, DMA_SIZE_8);              // 8-bit txfers
@@ -102,7 +128,7 @@ void initVGA() {
         &c0,                        // The configuration we just created
         &pio->txf[rgb_sm],          // write address (RGB PIO TX FIFO)
         &vga_data_array,            // The initial read address (pixel color array)
-        TXCOUNT,                    // Number of transfers; in this case each is 1 byte.
+        first_count,                // Number of transfers; in this case each is 1 byte.
         false                       // Don't start immediately.
     );
 
@@ -122,6 +148,13 @@ void initVGA() {
         false                               // Don't start immediately.
     );
 
+#if VGA_SCROLL
+    // Queue the next row whenever channel 0 finishes one
+    dma_channel_set_irq0_enabled(rgb_chan_0, true) ;
+    irq_set_exclusive_handler(DMA_IRQ_0, scrollLineHandler) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+#endif
+
     /////////////////////////////////////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -551,4 +584,41 @@ inline void writeString(char* str){
     while (*str){
         tft_write(*str++);
     }
-}
\ No newline at end of file
+}
+
+#if VGA_SCROLL
+// Show the rows y..y+h-1 rotated: screen row y+r shows the framebuffer row
+// y + (r + offset) % h. Drawing still goes to framebuffer rows, so a band
+// scrolls by drawing its new row and moving offset. h = 0 stops scrolling.
+// Takes effect at the start of the next frame.
+void setScroll(short y, short h, short offset) {
+    if (y < 0 || h <= 0 || y + h > _height) {
+        y = 0 ;
+        h = 0 ;
+    }
+    offset = h ? offset % h : 0 ;
+    if (offset < 0) offset += h ;
+    scroll_request = y | (h << 10) | (offset << 20) ;
+}
+
+// Channel 0 has just finished a scanline and channel 1 has restarted it on
+// the next, so name the row for the line after next
+static void __not_in_flash_func(scrollLineHandler)() {
+    dma_hw->ints0 = 1u << 0 ;
+    short y = scroll_next_line ;
+    if (y == 0) {
+        unsigned int request = scroll_request ;
+        scroll_y = request & 0x3ff ;
+        scroll_h = (request >> 10) & 0x3ff ;
+        scroll_offset = request >> 20 ;
+    }
+    short r = y - scroll_y ;
+    if (r >= 0 && r < scroll_h) {
+        r += scroll_offset ;
+        if (r >= scroll_h) r -= scroll_h ;
+        y = scroll_y + r ;
+    }
+    address_pointer = (char *)&vga_data_array[LINE_BYTES * y] ;
+    if (++scroll_next_line == _height) scroll_next_line = 0 ;
+}
+#endif
@@ -13,6 +13,7 @@
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
  *  - DMA channels 0, 1, 2, and 3
+ *  - DMA_IRQ_0 (channel 0), with VGA_SCROLL only
  *  - 153.6 kBytes of RAM (for pixel color data)
  *
  * NOTE
@@ -28,6 +29,14 @@ enum vga_pins {HSYNC=16, VSYNC, RED_PIN, GREEN_PIN, BLUE_PIN} ;
 // We can only produce 8 (3-bit) colors, so let's give them readable names - usable in main()
 enum colors {BLACK, RED, GREEN, YELLOW, BLUE, MAGENTA, CYAN, WHITE} ;
 
+// Scrolling: with VGA_SCROLL=1 the screen is sent one scanline at a time,
+// and a band of rows can be shown rotated (see setScroll), so scrolling it
+// costs no copying. The per-line DMA_IRQ_0 picks each row. Choose at
+// compile time, e.g. target_compile_definitions(fft PRIVATE VGA_SCROLL=1)
+#ifndef VGA_SCROLL
+#define VGA_SCROLL 0
+#endif
+
 // VGA primitives - usable in main
 void initVGA(void) ;
 void drawPixel(short x, short y, char color) ;
@@ -49,4 +58,7 @@ void setTextColor2(char c, char bg);
 void setTextSize(unsigned char s);
 void setTextWrap(char w);
 void tft_write(unsigned char c) ;
-void writeString(char* str) ;
\ No newline at end of file
+void writeString(char* str) ;
+#if VGA_SCROLL
+void setScroll(short y, short h, short offset) ;
+#endif
\ No newline at end of file
@@ -41,568 +41,190 @@
 #include "hardware/pll.h"
 // Include protothreads
 #include "pt_cornell_rp2040_v1.h"
+// Framebuffer capture over USB serial
+#include "vga_capture.h"
+// Boid state, neighbor search and update
+#include "boids_kernel.h"
 
 // Include integral type libraries
 #include <stdint.h>
 
-// === the fixed point macros ========================================
-typedef signed int fix15;
-#define multfix15(a, b) ((fix15)((((signed long long)(a)) * ((signed long long)(b))) >> 15))
-#define float2fix15(a) ((fix15)((a)*32768.0)) // 2^15
-#define fix2float15(a) ((float)(a) / 32768.0)
-#define absfix15(a) abs(a)
-#define int2fix15(a) ((fix15)(a << 15))
-#define fix2int15(a) ((int)(a >> 15))
-#define char2fix15(a) (fix15)(((fix15)(a)) << 15)
-#define divfix(a, b) (fix15)(div_s64s64((((signed long long)(a)) << 15), ((signed long long)(b))))
-#define sqrtfix(a) (float2fix15(sqrt(fix2float15(a))))
-
-// Wall detection
-#define hitBottom(b) (b > int2fix15(380))
-#define hitTop(b) (b < int2fix15(100))
-#define hitLeft(a) (a < int2fix15(100))
-#define hitRight(a) (a > int2fix15(540))
-
 // uS per frame
 #define FRAME_RATE 33000
-
-// Boid and predator structs
-struct boid
+// Vblanks per frame (2 = 30 fps, locked to the 60 Hz display)
+#define FRAME_VBLANKS 2
+
+// 0 = lock-step: both cores search, then both update and draw half the flock.
+// 1 = pipelined: core 1 simulates frame N+1 while core 0 draws frame N,
+//     then helps core 1 with the neighbor search.
+#ifndef PIPELINE
+#define PIPELINE 0
+#endif
+
+// Frame timing for each core's animation loop (see vga_graphics.h)
+struct vga_frames frames_0, frames_1;
+
+// End of statically allocated RAM and bottom of the stack (linker script)
+extern char __bss_end__, __StackLimit;
+
+// Barriers between the cores --> each waits for the other to synchronize animation
+#define BARRIER_LOCK 27 // hardware spinlock shared by the barriers
+struct pt_barrier barrier_spawn;  // both halves of the flock spawned
+struct pt_barrier barrier_search; // grid sorted and search planned
+struct pt_barrier barrier_update; // neighbor search done
+struct pt_barrier barrier_draw;   // boids updated and drawn
+struct pt_barrier barrier_frame;  // frame shown
+
+// Frame latency: from the start of simulating a frame to the vblank that shows it
+volatile uint32_t frame_latency_us = 0;
+
+// Frames simulated since the flock was last spawned (compare with boids_headless)
+volatile uint32_t sim_frame = 0;
+
+// Flock size governor: every GOVERNOR_FRAMES frames, grow or shrink the
+// flock so that the slowest of those frames leaves governor_margin_us of
+// the frame budget free
+#define GOVERNOR_FRAMES 8
+#define GOVERNOR_STEP_MAX 64 // most boids added at once
+#define GOVERNOR_MIN_BOIDS 2
+bool governor_on = true;
+int governor_margin_us = 2000;
+
+#if PIPELINE
+// Screen positions of one simulated frame, handed from the sim core to the
+// render core. Frame f is in slot f & 1; the sim core refills a slot only
+// after the render core has erased the frame that was in it.
+#define PIPE_XY(x, y) (((uint32_t)(uint16_t)(y) << 16) | (uint16_t)(x))
+#define PIPE_X(xy) ((short)((xy) & 0xffff))
+#define PIPE_Y(xy) ((short)((xy) >> 16))
+struct pipe_slot
 {
-    // Current state of boid
-    fix15 x;
-    fix15 y;
-    fix15 vx;
-    fix15 vy;
-
-    // Variables of current state needed for boid algo calculation
-    fix15 close_dx_0;
-    fix15 close_dy_0;
-    fix15 xpos_avg_0;
-    fix15 ypos_avg_0;
-    fix15 xvel_avg_0;
-    fix15 yvel_avg_0;
-    uint16_t neighboring_boids_0;
-    fix15 close_dx_1;
-    fix15 close_dy_1;
-    fix15 xpos_avg_1;
-    fix15 ypos_avg_1;
-    fix15 xvel_avg_1;
-    fix15 yvel_avg_1;
-    uint16_t neighboring_boids_1;
-    fix15 predator_dx;
-    fix15 predator_dy;
-    uint8_t num_predators;
+    uint32_t boid_xy[N_boids];
+    uint32_t predator_xy[N_predators];
+    uint16_t n_boids;
+    uint8_t n_predators;
+    uint32_t begin_time; // when the sim core started this frame
 };
-
-struct predator
-{
-    // Current state of predators
-    fix15 x;
-    fix15 y;
-    fix15 vx;
-    fix15 vy;
-};
-
-// Initializing boids
-#define N_boids 1209          // Total # of possible boids
-uint16_t curr_N_boids = 1209; // Current # of boids
-uint16_t half_N_boids = 604;
-struct boid boids[N_boids];
-
-// Initializing boid parameters
-fix15 turnfactor = float2fix15(0.2);
-fix15 visualRange = int2fix15(40);
-fix15 protectedRange = int2fix15(8);
-fix15 centeringfactor = float2fix15(0.0005);
-fix15 avoidfactor = float2fix15(0.05);
-fix15 matchingfactor = float2fix15(0.05);
-fix15 maxspeed = int2fix15(4);
-fix15 minspeed = int2fix15(2);
-
-// Initializing predator s
-#define N_predators 5         // Total # of possible predators
-uint8_t curr_N_predators = 0; // Current # of predators
-struct predator predators[N_predators];
-
-// Initializing predator parameters
-fix15 predatory_range = int2fix15(50);
-fix15 predator_turnfactor = float2fix15(0.5);
-
-// All boolean values for both cores --> will wait for other core to synchronize animation
-volatile bool still_running_0_current_update = true;
-volatile bool still_running_0_spawn = true;
-volatile bool still_running_0_draw = true;
-volatile bool still_running_1_current_update = true;
-volatile bool still_running_1_spawn = true;
-volatile bool still_running_1_draw = true;
-volatile bool still_running_0_string_output = true;
-volatile bool still_running_1_string_output = true;
-
-// Margin Size
-uint16_t x_margin_left_box = 100;
-uint16_t x_margin_right_box = 540;
-uint16_t x_change_margin_box = 440;
-uint16_t y_margin_top_box = 100;
-uint16_t y_margin_bottom_box = 380;
-uint16_t y_change_margin_box = 280;
-uint8_t should_draw = 1;
-
-// Vertical Line Size
-uint16_t x_margin_left_V_line = 200;
-uint16_t x_margin_right_V_line = 440;
-uint16_t y_margin_top_line = 0;
-uint16_t y_change_margin_line = 480;
-
-// Screen Size
-uint16_t y_screen_top = 0;
-uint16_t y_screen_bottom = 480;
-uint16_t x_screen_left = 0;
-uint16_t x_screen_right = 640;
+struct pipe_slot pipe_slots[2];
+volatile uint32_t pipe_published = 0; // last frame the sim core finished
+volatile uint32_t pipe_released = 0;  // last frame the render core erased
+volatile uint32_t pipe_sim_us = 0;    // sim core time for the last frame
+
+// Core 0 helps with the neighbor search once it has drawn its frame. Core 1
+// opens the search after planning it and closes it when no chunks are left,
+// then waits for core 0 to leave it before updating the boids.
+volatile bool pipe_search_open = false;
+volatile bool pipe_helping = false;
+
+// The serial thread stops the sim core between frames to change the flock
+volatile bool pipe_hold = false;
+volatile bool pipe_held = false;
+#define SIM_PAUSE(pt) do { pipe_hold = true; PT_YIELD_UNTIL(pt, pipe_held); } while (0)
+#define SIM_RESUME() do { pipe_hold = false; } while (0)
+// RAM per boid, with its screen position in both pipeline slots
+#define BOID_RAM_BYTES (BOID_BYTES + 2 * sizeof(uint32_t))
+#else
+#define SIM_PAUSE(pt)
+#define SIM_RESUME()
+#define BOID_RAM_BYTES BOID_BYTES
+#endif
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Spawn boid or predator by assigning its position and velocity
-void spawn(fix15 *x, fix15 *y, fix15 *vx, fix15 *vy)
+// Flock size for the next frame, from this frame's busy time and the
+// running count of missed vblanks
+uint16_t governor_update(uint32_t busy_us, unsigned int overruns)
 {
-    *x = int2fix15(rand() % 640);
-    *y = int2fix15(rand() % 480);
-    *vx = int2fix15(rand() % 3 + 3);
-    *vy = int2fix15(rand() % 3 + 3);
-}
+    static uint32_t worst_us = 0;
+    static uint8_t count = 0;
+    static unsigned int last_overruns = 0;
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-// Draw the boundaries
-void drawArena(int should_draw)
-{
-    if (should_draw == 1)
+    if (busy_us > worst_us)
     {
-        // Draws a box on the screen
-        drawVLine(x_margin_left_box, y_margin_top_box, y_change_margin_box, WHITE);
-        drawVLine(x_margin_right_box, y_margin_top_box, y_change_margin_box, WHITE);
-        drawHLine(x_margin_left_box, y_margin_top_box, x_change_margin_box, WHITE);
-        drawHLine(x_margin_left_box, y_margin_bottom_box, x_change_margin_box, WHITE);
+        worst_us = busy_us;
     }
-    else if (should_draw == 2)
+    if (++count < GOVERNOR_FRAMES)
     {
-        // Draws 2 vertical lines on the screen
-        drawVLine(x_margin_left_V_line, y_margin_top_line, y_change_margin_line, WHITE);
-        drawVLine(x_margin_right_V_line, y_margin_top_line, y_change_margin_line, WHITE);
+        return curr_N_boids;
     }
-}
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-// Boid_algo initial calculation for i_0 boid
-void boid_algo_init_calc_core0(uint16_t i_0, uint16_t i_1, bool second_cycle)
-{
-    // Initializes values only needed for each boid cycle
-    fix15 squared_distance_0;
-    fix15 dx_i_0;
-    fix15 dy_i_0;
-
-    fix15 squared_predator_distance_0;
-    fix15 dx_p_0;
-    fix15 dy_p_0;
-
-    uint16_t lower = i_0 + 1;
-    uint16_t upper = half_N_boids;
-
-    // If first cycle, then calculate core 0 boid update. Cycles alternate each time step
-    if (second_cycle)
+    // Spare time past the margin, spent at the current cost per boid. Take
+    // half of it each time so the flock settles instead of overshooting.
+    int slack = FRAME_VBLANKS * 16667 - (int)worst_us - governor_margin_us;
+    int per_boid = worst_us / (curr_N_boids ? curr_N_boids : 1);
+    if (per_boid < 1)
     {
-        lower = half_N_boids;
-        upper = i_1 + 1;
+        per_boid = 1;
     }
+    int step = slack / per_boid / 2;
 
-    for (uint16_t j = lower; j < upper; j++)
+    // A dropped frame means the estimate is off, back off by an eighth
+    // at least
+    if (overruns != last_overruns && step > -(curr_N_boids >> 3))
     {
-        dx_i_0 = boids[i_0].x - boids[j].x;
-        dy_i_0 = boids[i_0].y - boids[j].y;
-        // Are both those differences less than the visual range?
-        if (absfix15(dx_i_0) < visualRange && absfix15(dy_i_0) < visualRange)
-        {
-            // Are both those differences less than the protected range?
-            if (absfix15(dx_i_0) < protectedRange && absfix15(dy_i_0) < protectedRange)
-            {
-                // If so, add dx and dy to close_dx and close_dy for current boid
-                boids[i_0].close_dx_0 += dx_i_0;
-                boids[i_0].close_dy_0 += dy_i_0;
-
-                // If so, subtract dx and dy to close_dx and close_dy for other boid
-                boids[j].close_dx_0 -= dx_i_0;
-                boids[j].close_dy_0 -= dy_i_0;
-            }
-
-            else // Boid is in the visual range
-            {
-                // Add other boid's x/y-coord and x/y vel to accumulator variables to boids
-                boids[i_0].xpos_avg_0 += boids[j].x;
-                boids[i_0].ypos_avg_0 += boids[j].y;
-                boids[i_0].xvel_avg_0 += boids[j].vx;
-                boids[i_0].yvel_avg_0 += boids[j].vy;
-                // Add boid's x/y-coord and x/y vel to accumulator variables to other boids
-                boids[j].xpos_avg_0 += boids[i_0].x;
-                boids[j].ypos_avg_0 += boids[i_0].y;
-                boids[j].xvel_avg_0 += boids[i_0].vx;
-                boids[j].yvel_avg_0 += boids[i_0].vy;
-
-                // Increment number of boids within visual range to both the current and other boid
-                boids[i_0].neighboring_boids_0++;
-                boids[j].neighboring_boids_0++;
-            }
-        }
+        step = -(curr_N_boids >> 3);
     }
-    for (uint8_t k = 0; k < curr_N_predators; k++)
+    // Grow gradually, but shrink as fast as the estimate says
+    if (step > GOVERNOR_STEP_MAX)
     {
-        // Compute the differences in x and y coordinates
-        dx_p_0 = boids[i_0].x - predators[k].x;
-        dy_p_0 = boids[i_0].y - predators[k].y;
-
-        // Are both those differences less than the predatory range?
-        if (absfix15(dx_p_0) < predatory_range && absfix15(dx_p_0) < predatory_range)
-        {
-            boids[i_0].predator_dx += boids[i_0].x - predators[k].x;
-            boids[i_0].predator_dy += boids[i_0].y - predators[k].y;
-
-            // Increment the number of predators in the boid's predatory range
-            boids[i_0].num_predators++;
-        }
+        step = GOVERNOR_STEP_MAX;
     }
-}
-
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-// Boid_algo initial calculation for i_1 boid
-void boid_algo_init_calc_core1(uint16_t i_0, uint16_t i_1, bool second_cycle)
-{
-    // Initializes values only needed for each boid cycle
-    fix15 squared_distance_1;
-    fix15 dx_i_1;
-    fix15 dy_i_1;
 
-    fix15 squared_predator_distance_1;
-    fix15 dx_p_1;
-    fix15 dy_p_1;
-
-    uint16_t upper = i_1 - 1;
-    uint16_t lower = half_N_boids - 1;
-
-    // If first cycle, then calculate core 0 boid update. Cycles alternate each time step
-    if (second_cycle)
+    int n = curr_N_boids + step;
+    if (n < GOVERNOR_MIN_BOIDS)
     {
-        upper = half_N_boids - 1;
-        lower = i_0;
+        n = GOVERNOR_MIN_BOIDS;
     }
-
-    for (uint16_t j = upper; j > lower; j--)
+    if (n > N_boids)
     {
-        dx_i_1 = boids[i_1].x - boids[j].x;
-        dy_i_1 = boids[i_1].y - boids[j].y;
-
-        // Are both those differences less than the visual range?
-        if (absfix15(dx_i_1) < visualRange && absfix15(dy_i_1) < visualRange)
-        {
-            // Are both those differences less than the protected range?
-            if (absfix15(dx_i_1) < protectedRange && absfix15(dy_i_1) < protectedRange)
-            {
-                // If so, add dx and dy to close_dx and close_dy for current boid
-                boids[i_1].close_dx_1 += dx_i_1;
-                boids[i_1].close_dy_1 += dy_i_1;
-
-                // If so, subtract dx and dy to close_dx and close_dy for other boid
-                boids[j].close_dx_1 -= dx_i_1;
-                boids[j].close_dy_1 -= dy_i_1;
-            }
-            else // Boid is in the visual range
-            {
-                // Add other boid's x/y-coord and x/y vel to accumulator variables to boids
-                boids[i_1].xpos_avg_1 += boids[j].x;
-                boids[i_1].ypos_avg_1 += boids[j].y;
-                boids[i_1].xvel_avg_1 += boids[j].vx;
-                boids[i_1].yvel_avg_1 += boids[j].vy;
-
-                // Add boid's x/y-coord and x/y vel to accumulator variables to other boids
-                boids[j].xpos_avg_1 += boids[i_1].x;
-                boids[j].ypos_avg_1 += boids[i_1].y;
-                boids[j].xvel_avg_1 += boids[i_1].vx;
-                boids[j].yvel_avg_1 += boids[i_1].vy;
-
-                // Increment number of boids within visual range to both the current and other boid
-                boids[i_1].neighboring_boids_1++;
-                boids[j].neighboring_boids_1++;
-            }
-        }
+        n = N_boids;
     }
-    for (uint8_t k = 0; k < curr_N_predators; k++)
-    {
-        // Compute the differences in x and y coordinates
-        dx_p_1 = boids[i_1].x - predators[k].x;
-        dy_p_1 = boids[i_1].y - predators[k].y;
 
-        // Are both those differences less than the predatory range?
-        if (absfix15(dx_p_1) < predatory_range && absfix15(dx_p_1) < predatory_range)
-        {
-            boids[i_1].predator_dx += boids[i_1].x - predators[k].x;
-            boids[i_1].predator_dy += boids[i_1].y - predators[k].y;
-
-            // Increment the number of predators in the boid's predatory range
-            boids[i_1].num_predators++;
-        }
-    }
+    worst_us = 0;
+    count = 0;
+    last_overruns = overruns;
+    return n;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Update the x and y positions of each boid
-void boid_algo_update(uint16_t i_update)
+// Outline the obstacles
+void drawObstacles(char color)
 {
-    // Sum the values from each core for boid update
-    fix15 close_dx = boids[i_update].close_dx_0 + boids[i_update].close_dx_1;
-    fix15 close_dy = boids[i_update].close_dy_0 + boids[i_update].close_dy_1;
-    fix15 xpos_avg = boids[i_update].xpos_avg_0 + boids[i_update].xpos_avg_1;
-    fix15 ypos_avg = boids[i_update].ypos_avg_0 + boids[i_update].ypos_avg_1;
-    fix15 xvel_avg = boids[i_update].xvel_avg_0 + boids[i_update].xvel_avg_1;
-    fix15 yvel_avg = boids[i_update].yvel_avg_0 + boids[i_update].yvel_avg_1;
-    uint16_t neighboring_boids = boids[i_update].neighboring_boids_0 + boids[i_update].neighboring_boids_1;
-
-    // Initializes values only needed for each boid update
-    fix15 neighboring_boids_div;
-    fix15 fin_xpos_avg;
-    fix15 fin_ypos_avg;
-    fix15 fin_xvel_avg;
-    fix15 fin_yvel_avg;
-    fix15 speed;
-
-    // If there were any boids in the visual range
-    if (neighboring_boids > 0)
-    {
-        // Divide accumulator variables by number of boids in visual range
-        neighboring_boids_div = int2fix15(neighboring_boids);
-        fin_xpos_avg = divfix(xpos_avg, neighboring_boids_div);
-        fin_ypos_avg = divfix(ypos_avg, neighboring_boids_div);
-        fin_xvel_avg = divfix(xvel_avg, neighboring_boids_div);
-        fin_yvel_avg = divfix(yvel_avg, neighboring_boids_div);
-
-        // Add the centering/matching contributions to velocity
-        boids[i_update].vx = (boids[i_update].vx +
-                              multfix15(fin_xpos_avg - boids[i_update].x, centeringfactor) +
-                              multfix15(fin_xvel_avg - boids[i_update].vx, matchingfactor));
-        boids[i_update].vy = (boids[i_update].vy +
-                              multfix15(fin_ypos_avg - boids[i_update].y, centeringfactor) +
-                              multfix15(fin_yvel_avg - boids[i_update].vy, matchingfactor));
-    }
-
-    // Add the avoidance contribution to velocity
-    boids[i_update].vx = boids[i_update].vx + multfix15(close_dx, avoidfactor);
-    boids[i_update].vy = boids[i_update].vy + multfix15(close_dy, avoidfactor);
-
-    // If the boid is near box or lines, make it turn by turnfactor
-    if (should_draw == 0) // no box or lines, wrap everywhere
-    {
-        if (boids[i_update].y < int2fix15(y_screen_top))
-        {
-            boids[i_update].y = int2fix15(y_screen_bottom);
-        }
-        if (boids[i_update].y > int2fix15(y_screen_bottom))
-        {
-            boids[i_update].y = int2fix15(y_screen_top);
-        }
-        if (boids[i_update].x < int2fix15(x_screen_left))
-        {
-            boids[i_update].x = int2fix15(x_screen_right);
-        }
-        if (boids[i_update].x > int2fix15(x_screen_right))
-        {
-            boids[i_update].x = int2fix15(x_screen_left);
-        }
-    }
-    else if (should_draw == 1) // if should_draw == 1 --> box
-    {
-        if (boids[i_update].y < int2fix15(y_margin_top_box))
-        {
-            boids[i_update].vy = boids[i_update].vy + turnfactor;
-        }
-        if (boids[i_update].y > int2fix15(y_margin_bottom_box))
-        {
-            boids[i_update].vy = boids[i_update].vy - turnfactor;
-        }
-        if (boids[i_update].x < int2fix15(x_margin_left_box))
-        {
-            boids[i_update].vx = boids[i_update].vx + turnfactor;
-        }
-        if (boids[i_update].x > int2fix15(x_margin_right_box))
-        {
-            boids[i_update].vx = boids[i_update].vx - turnfactor;
-        }
-    }
-    else // should_draw == 2 --> draw 2 lines, wrap only on top and bottom
-    {
-        if (boids[i_update].y < int2fix15(y_screen_top))
-        {
-            boids[i_update].y = int2fix15(y_screen_bottom);
-        }
-        if (boids[i_update].y > int2fix15(y_screen_bottom))
-        {
-            boids[i_update].y = int2fix15(y_screen_top);
-        }
-        if (boids[i_update].x < int2fix15(x_margin_left_V_line))
-        {
-            boids[i_update].vx = boids[i_update].vx + turnfactor;
-        }
-        if (boids[i_update].x > int2fix15(x_margin_right_V_line))
-        {
-            boids[i_update].vx = boids[i_update].vx - turnfactor;
-        }
-    }
-
-    // If there were any predators in the predatory range, turn away
-    if (boids[i_update].num_predators > 0)
+    for (uint8_t k = 0; k < n_obstacles; k++)
     {
-        if (boids[i_update].predator_dy > 0)
-        {
-            boids[i_update].vy = boids[i_update].vy + predator_turnfactor;
-        }
-        if (boids[i_update].predator_dy < 0)
+        struct obstacle *o = &obstacles[k];
+        if (o->kind == OBSTACLE_DISC)
         {
-            boids[i_update].vy = boids[i_update].vy - predator_turnfactor;
+            drawCircle(o->x0, o->y0, o->x1, color);
         }
-        if (boids[i_update].predator_dx > 0)
-        {
-            boids[i_update].vx = boids[i_update].vx + predator_turnfactor;
-        }
-        if (boids[i_update].predator_dx < 0)
+        else
         {
-            boids[i_update].vx = boids[i_update].vx - predator_turnfactor;
+            drawRect(o->x0, o->y0, o->x1 - o->x0 + 1, o->y1 - o->y0 + 1, color);
         }
     }
-    //////////////////////////////////
-
-    // Calculate the boid's speed
-    // Calculated using the alpha beta max algorithm
-    // speed = 1*v_max + 1/4 * v_min --> shift by 2 instead of multiply 0.25
-    if (absfix15(boids[i_update].vx) < absfix15(boids[i_update].vy))
-    {
-
-        speed = absfix15(boids[i_update].vy) + (absfix15(boids[i_update].vx) >> 2);
-    }
-    else
-    {
-        speed = absfix15(boids[i_update].vx) + (absfix15(boids[i_update].vy) >> 2);
-    }
-
-    if (speed > maxspeed)
-    {
-        boids[i_update].vx = boids[i_update].vx - (boids[i_update].vx >> 2);
-        boids[i_update].vy = boids[i_update].vy - (boids[i_update].vy >> 2);
-    }
-    if (speed < minspeed)
-    {
-        boids[i_update].vx = boids[i_update].vx + (boids[i_update].vx >> 2);
-        boids[i_update].vy = boids[i_update].vy + (boids[i_update].vy >> 2);
-    }
-
-    // Update position using velocity
-    boids[i_update].x = boids[i_update].x + boids[i_update].vx;
-    boids[i_update].y = boids[i_update].y + boids[i_update].vy;
 }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-void predator_algo(uint8_t l)
+// Draw the boundaries
+void drawArena(int should_draw)
 {
-    fix15 speed;
-    // If the predator is near an edge, make it turn by turnfactor
-    // (this describes a box, will vary based on boundary conditions)
-    if (should_draw == 0) // wrap everywhere
-    {
-        if (predators[l].y < int2fix15(y_screen_top))
-        {
-            predators[l].y = int2fix15(y_screen_bottom);
-        }
-        if (predators[l].y > int2fix15(y_screen_bottom))
-        {
-            predators[l].y = int2fix15(y_screen_top);
-        }
-        if (predators[l].x < int2fix15(x_screen_left))
-        {
-            predators[l].x = int2fix15(x_screen_right);
-        }
-        if (predators[l].x > int2fix15(x_screen_right))
-        {
-            predators[l].x = int2fix15(x_screen_left);
-        }
-    }
-    else if (should_draw == 1) // if should_draw == 1 --> box
-    {
-        if (predators[l].y < int2fix15(y_margin_top_box))
-        {
-            predators[l].vy = predators[l].vy + turnfactor;
-        }
-        if (predators[l].y > int2fix15(y_margin_bottom_box))
-        {
-            predators[l].vy = predators[l].vy - turnfactor;
-        }
-        if (predators[l].x < int2fix15(x_margin_left_box))
-        {
-            predators[l].vx = predators[l].vx + turnfactor;
-        }
-        if (predators[l].x > int2fix15(x_margin_right_box))
-        {
-            predators[l].vx = predators[l].vx - turnfactor;
-        }
-    }
-    else // should_draw == 2 --> draw 2 lines, wrap only on top and bottom
-    {
-        if (predators[l].y < int2fix15(y_screen_top))
-        {
-            predators[l].y = int2fix15(y_screen_bottom);
-        }
-        if (predators[l].y > int2fix15(y_screen_bottom))
-        {
-            predators[l].y = int2fix15(y_screen_top);
-        }
-        if (predators[l].x < int2fix15(x_margin_left_V_line))
-        {
-            predators[l].vx = predators[l].vx + turnfactor;
-        }
-        if (predators[l].x > int2fix15(x_margin_right_V_line))
-        {
-            predators[l].vx = predators[l].vx - turnfactor;
-        }
-    }
-
-    // Calculate the predator's speed
-    if (absfix15(predators[l].vx) < absfix15(predators[l].vy))
-    {
-        speed = absfix15(predators[l].vy) + (absfix15(predators[l].vx) >> 2);
-    }
-    else
-    {
-        speed = absfix15(predators[l].vx) + (absfix15(predators[l].vy) >> 2);
-    }
-
-    if (speed > maxspeed)
+    if (should_draw == 1)
     {
-        predators[l].vx = predators[l].vx - (predators[l].vx >> 2);
-        predators[l].vy = predators[l].vy - (predators[l].vy >> 2);
+        // Draws a box on the screen
+        drawVLine(x_margin_left_box, y_margin_top_box, y_change_margin_box, WHITE);
+        drawVLine(x_margin_right_box, y_margin_top_box, y_change_margin_box, WHITE);
+        drawHLine(x_margin_left_box, y_margin_top_box, x_change_margin_box, WHITE);
+        drawHLine(x_margin_left_box, y_margin_bottom_box, x_change_margin_box, WHITE);
     }
-    if (speed < minspeed)
+    else if (should_draw == 2)
     {
-        predators[l].vx = predators[l].vx + (predators[l].vx >> 2);
-        predators[l].vy = predators[l].vy + (predators[l].vy >> 2);
+        // Draws 2 vertical lines on the screen
+        drawVLine(x_margin_left_V_line, y_margin_top_line, y_change_margin_line, WHITE);
+        drawVLine(x_margin_right_V_line, y_margin_top_line, y_change_margin_line, WHITE);
     }
-
-    // Update position using velocity
-    predators[l].x = predators[l].x + predators[l].vx;
-    predators[l].y = predators[l].y + predators[l].vy;
+    drawObstacles(WHITE);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -656,10 +278,25 @@ static PT_THREAD(protothread_serial(struct pt *pt))
             printf("matchingfactor\n\r");
             printf("numberBoids\n\r");
             printf("numberPredators\n\r");
+            printf("capture <frames, -1 = until 'capture 0'>\n\r");
+            printf("frames\n\r");
+            printf("search pairs/grid/sweep\n\r");
+            printf("pfield on/off\n\r");
+            printf("memory\n\r");
+            printf("work\n\r");
+            printf("barriers\n\r");
+            printf("seed <n>\n\r");
+            printf("checksum\n\r");
+            printf("governor on/off/<margin us>\n\r");
+            printf("obstacle rect <x0> <y0> <x1> <y1>\n\r");
+            printf("obstacle disc <x> <y> <r>\n\r");
+            printf("obstacle clear/on/off/range <px>\n\r");
         }
         else if (strcmp(cmd, "draw") == 0)
         {
             // Draws either the 2 vertical lines, the box, or nothing depending on the request
+            // (with the sim core stopped, so it never steers by a half-baked field)
+            SIM_PAUSE(pt);
             if (strcmp(arg1, "line") == 0)
             {
                 should_draw = 2;
@@ -685,6 +322,49 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 drawVLine(x_margin_left_V_line, y_margin_top_line, y_change_margin_line, BLACK);
                 drawVLine(x_margin_right_V_line, y_margin_top_line, y_change_margin_line, BLACK);
             }
+            // the walls moved, so bake them into the obstacle field
+            ofield_bake();
+            SIM_RESUME();
+        }
+        else if (strcmp(cmd, "obstacle") == 0)
+        {
+            // add a rectangle or a disc, remove them all, steer by the
+            // field or by the arena walls alone, or set how close to a
+            // wall the boids turn
+            int v[4] = {0, 0, 0, 0};
+            for (uint8_t k = 0; k < 4 && (token = strtok(NULL, " ")) != NULL; k++)
+            {
+                v[k] = atoi(token);
+            }
+            SIM_PAUSE(pt);
+            if (strcmp(arg1, "rect") == 0 || strcmp(arg1, "disc") == 0)
+            {
+                uint8_t kind = (arg1[0] == 'r') ? OBSTACLE_RECT : OBSTACLE_DISC;
+                if (!obstacle_add(kind, v[0], v[1], v[2], v[3]))
+                {
+                    printf("at most %d obstacles\n\r", OBSTACLES_MAX);
+                }
+            }
+            else if (strcmp(arg1, "clear") == 0)
+            {
+                drawObstacles(BLACK);
+                n_obstacles = 0;
+            }
+            else if (strcmp(arg1, "on") == 0)
+            {
+                use_ofield = true;
+            }
+            else if (strcmp(arg1, "off") == 0)
+            {
+                use_ofield = false;
+            }
+            else if (strcmp(arg1, "range") == 0)
+            {
+                ofield_range = v[0];
+            }
+            ofield_bake();
+            SIM_RESUME();
+            printf("%d obstacles, field %s, range %d px\n\r", n_obstacles, use_ofield ? "on" : "off", ofield_range);
         }
         // For each parameter, the serial monitor reads the parameter value and alters it
         else if (strcmp(cmd, "turnfactor") == 0)
@@ -696,16 +376,22 @@ static PT_THREAD(protothread_serial(struct pt *pt))
         }
         else if (strcmp(cmd, "visualrange") == 0)
         {
+            // the grid and sweep are laid out for the visual range, so
+            // only change it between frames
             if (arg1 != NULL)
             {
+                SIM_PAUSE(pt);
                 visualRange = int2fix15(atoi(arg1));
+                SIM_RESUME();
             }
         }
         else if (strcmp(cmd, "protectedrange") == 0)
         {
             if (arg1 != NULL)
             {
+                SIM_PAUSE(pt);
                 protectedRange = int2fix15(atoi(arg1));
+                SIM_RESUME();
             }
         }
         else if (strcmp(cmd, "centeringfactor") == 0)
@@ -732,38 +418,187 @@ static PT_THREAD(protothread_serial(struct pt *pt))
         else if (strcmp(cmd, "numberBoids") == 0)
         {
             // erase predators and boids, and rerandomize initialization
+            // (a fixed flock size turns the governor off)
             if (arg1 != NULL)
             {
+                governor_on = false;
+                SIM_PAUSE(pt);
                 for (uint16_t i = 0; i < curr_N_boids; i++)
                 {
-                    drawPixel(fix2int15(boids[i].x), fix2int15(boids[i].y), BLACK);
+                    drawPixel(fix2int15(BOID_X(i)), fix2int15(BOID_Y(i)), BLACK);
                 }
                 for (uint8_t l = 0; l < curr_N_predators; l++)
                 {
                     drawRect(fix2int15(predators[l].x), fix2int15(predators[l].y), 2, 2, BLACK);
                 }
 
-                curr_N_boids = (uint16_t)(atoi(arg1));
+                int n = atoi(arg1);
+                if (n > N_boids)
+                {
+                    n = N_boids;
+                }
+                curr_N_boids = (uint16_t)(n > 0 ? n : 0);
                 half_N_boids = curr_N_boids >> 1;
 
                 for (uint16_t i = 0; i < curr_N_boids; i++)
                 {
-                    spawn(&boids[i].x, &boids[i].y, &boids[i].vx, &boids[i].vy);
+                    boid_spawn(i);
                 }
                 for (uint8_t l = 0; l < curr_N_predators; l++)
                 {
                     spawn(&predators[l].x, &predators[l].y, &predators[l].vx, &predators[l].vy);
                 }
+                SIM_RESUME();
+            }
+        }
+        else if (strcmp(cmd, "search") == 0)
+        {
+            // compare every pair of boids, look in the grid, or sweep by x
+            // (between frames, so no chunk runs under another mode's plan)
+            SIM_PAUSE(pt);
+            if (strcmp(arg1, "pairs") == 0)
+            {
+                search_mode = SEARCH_PAIRS;
+            }
+            else if (strcmp(arg1, "grid") == 0)
+            {
+                search_mode = SEARCH_GRID;
             }
+            else if (strcmp(arg1, "sweep") == 0)
+            {
+                search_mode = SEARCH_SWEEP;
+            }
+            SIM_RESUME();
+        }
+        else if (strcmp(cmd, "pfield") == 0)
+        {
+            // look predators up in the field, or check every predator for every boid
+            SIM_PAUSE(pt);
+            if (strcmp(arg1, "on") == 0)
+            {
+                use_pfield = true;
+            }
+            else if (strcmp(arg1, "off") == 0)
+            {
+                use_pfield = false;
+            }
+            SIM_RESUME();
+        }
+        else if (strcmp(cmd, "memory") == 0)
+        {
+            // RAM per boid, and how many more boids the free RAM would hold
+            unsigned int free_ram = &__StackLimit - &__bss_end__;
+            printf("%d bytes per boid, %d boids allocated (%d bytes)\n\r", (int)BOID_RAM_BYTES, N_boids, (int)(N_boids * BOID_RAM_BYTES));
+            printf("%u bytes free beside the framebuffer, room for %u more boids\n\r", free_ram, (unsigned int)(free_ram / BOID_RAM_BYTES));
+        }
+        else if (strcmp(cmd, "work") == 0)
+        {
+            // how the last frame's neighbor search was shared between the cores
+            printf("%d chunks: core 0 took %d in %u us, core 1 took %d in %u us\n\r", work_chunks,
+                   work_claimed[0], (unsigned int)work_busy_us[0], work_claimed[1], (unsigned int)work_busy_us[1]);
+        }
+        else if (strcmp(cmd, "seed") == 0)
+        {
+            // respawn the flock from a seed, as boids_headless -s does
+            // (boids_headless has no governor, so this turns it off)
+            if (arg1 != NULL)
+            {
+                governor_on = false;
+                SIM_PAUSE(pt);
+                for (uint16_t i = 0; i < curr_N_boids; i++)
+                {
+                    drawPixel(fix2int15(BOID_X(i)), fix2int15(BOID_Y(i)), BLACK);
+                }
+                for (uint8_t l = 0; l < curr_N_predators; l++)
+                {
+                    drawRect(fix2int15(predators[l].x), fix2int15(predators[l].y), 2, 2, BLACK);
+                }
+                boid_seed((uint32_t)atoi(arg1));
+                for (uint16_t i = 0; i < curr_N_boids; i++)
+                {
+                    boid_spawn(i);
+                }
+                for (uint8_t l = 0; l < curr_N_predators; l++)
+                {
+                    spawn(&predators[l].x, &predators[l].y, &predators[l].vx, &predators[l].vy);
+                }
+                sim_frame = 0;
+                SIM_RESUME();
+            }
+        }
+        else if (strcmp(cmd, "governor") == 0)
+        {
+            // automatic flock size, or the frame slack it keeps free
+            if (strcmp(arg1, "on") == 0)
+            {
+                governor_on = true;
+            }
+            else if (strcmp(arg1, "off") == 0)
+            {
+                governor_on = false;
+            }
+            else
+            {
+                governor_margin_us = atoi(arg1);
+            }
+            printf("governor %s, margin %d us, %d boids\n\r", governor_on ? "on" : "off", governor_margin_us, curr_N_boids);
+        }
+        else if (strcmp(cmd, "checksum") == 0)
+        {
+            // boid state hash, same as boids_headless prints for this frame
+            SIM_PAUSE(pt);
+            printf("frame %u checksum %08x\n\r", (unsigned int)sim_frame, (unsigned int)boid_checksum());
+            SIM_RESUME();
+        }
+        else if (strcmp(cmd, "barriers") == 0)
+        {
+            // time each core spent waiting for the other, last frame and on average
+            struct pt_barrier *barriers[5] = {&barrier_spawn, &barrier_search, &barrier_update, &barrier_draw, &barrier_frame};
+            const char *names[5] = {"spawn", "search", "update", "draw", "frame"};
+            for (uint8_t k = 0; k < 5; k++)
+            {
+                struct pt_barrier *b = barriers[k];
+                unsigned int passes = b->passes ? b->passes : 1;
+                printf("%-7s core 0 waited %6u us (avg %6u), core 1 waited %6u us (avg %6u)\n\r", names[k],
+                       b->wait_us[0], b->total_us[0] / passes, b->wait_us[1], b->total_us[1] / passes);
+            }
+        }
+        else if (strcmp(cmd, "frames") == 0)
+        {
+            // frame counts, dropped vblanks, and frame-time histogram per core
+            printf("core 0: ");
+            vgaFramePrint(&frames_0);
+#if !PIPELINE
+            // the pipelined sim core isn't locked to vblank
+            printf("core 1: ");
+            vgaFramePrint(&frames_1);
+#endif
+            printf("latency %u us\n\r", (unsigned int)frame_latency_us);
+#if PIPELINE
+            printf("core 1 simulation %u us per frame\n\r", (unsigned int)pipe_sim_us);
+#endif
+        }
+        else if (strcmp(cmd, "capture") == 0)
+        {
+            // stream frames to vga_capture.py over the USB port
+#if VGA_CONSOLE != VGA_CONSOLE_ONLY
+            if (arg1 != NULL)
+            {
+                vga_capture_frames = atoi(arg1);
+            }
+#else
+            printf("no framebuffer to capture in a console-only build\n\r");
+#endif
         }
         else if (strcmp(cmd, "numberPredators") == 0)
         {
             // erase predators and boids, and rerandomize initialization
             if (arg1 != NULL)
             {
+                SIM_PAUSE(pt);
                 for (uint16_t i = 0; i < curr_N_boids; i++)
                 {
-                    drawPixel(fix2int15(boids[i].x), fix2int15(boids[i].y), BLACK);
+                    drawPixel(fix2int15(BOID_X(i)), fix2int15(BOID_Y(i)), BLACK);
                 }
 
                 for (uint8_t l = 0; l < curr_N_predators; l++)
@@ -771,14 +606,19 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                     drawRect(fix2int15(predators[l].x), fix2int15(predators[l].y), 2, 2, BLACK);
                 }
                 curr_N_predators = (uint8_t)(atoi(arg1));
+                if (curr_N_predators > N_predators)
+                {
+                    curr_N_predators = N_predators;
+                }
                 for (uint16_t i = 0; i < curr_N_boids; i++)
                 {
-                    spawn(&boids[i].x, &boids[i].y, &boids[i].vx, &boids[i].vy);
+                    boid_spawn(i);
                 }
                 for (uint8_t l = 0; l < curr_N_predators; l++)
                 {
                     spawn(&predators[l].x, &predators[l].y, &predators[l].vx, &predators[l].vy);
                 }
+                SIM_RESUME();
             }
         }
         else
@@ -790,6 +630,38 @@ static PT_THREAD(protothread_serial(struct pt *pt))
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Text overlay in the top left corner, one line per string
+#define HUD_LINES 6
+void drawHud(char lines[HUD_LINES][20])
+{
+#if VGA_CONSOLE
+    // Console cells are rewritten in place, no need to erase first
+    for (uint8_t l = 0; l < HUD_LINES; l++)
+    {
+        consoleWriteString(1, 1 + 2 * l, "                  ", WHITE, BLACK);
+        consoleWriteString(1, 1 + 2 * l, lines[l], WHITE, BLACK);
+    }
+#else
+    fillRect(0, 0, 150, 10 + 15 * HUD_LINES, BLACK);
+    for (uint8_t l = 0; l < HUD_LINES; l++)
+    {
+        setCursor(10, 10 + 15 * l);
+        setTextColor(WHITE);
+        setTextSize(1);
+        writeString(lines[l]);
+    }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !PIPELINE
+// Flock size core 0 planned when it opened the frame barrier. Core 1 clears
+// its neighbor sums for this many boids, since the serial thread may change
+// curr_N_boids while core 0 is still waiting at the barrier.
+volatile uint16_t frame_N_boids = 0;
+
 // Animation on core 0
 static PT_THREAD(protothread_anim(struct pt *pt))
 {
@@ -801,15 +673,12 @@ static PT_THREAD(protothread_anim(struct pt *pt))
     static int spare_time_0;
     static int total_time_0 = 0;
     static int counter_0 = 0;
-    char str1[10];
-    char str2[18];
-    // char str3[25];
-    char str4[11];
+    char hud[HUD_LINES][20];
 
-    // Spawn first half of boid flock
-    for (uint16_t current_boid_0 = 0; current_boid_0 < half_N_boids; current_boid_0++)
+    // Spawn the boid flock from this core only, so a seed always gives the same flock
+    for (uint16_t current_boid_0 = 0; current_boid_0 < curr_N_boids; current_boid_0++)
     {
-        spawn(&boids[current_boid_0].x, &boids[current_boid_0].y, &boids[current_boid_0].vx, &boids[current_boid_0].vy);
+        boid_spawn(current_boid_0);
     }
 
     // Spawn all predators
@@ -819,76 +688,48 @@ static PT_THREAD(protothread_anim(struct pt *pt))
     }
 
     // Wait for other thread to stop spawning
-    still_running_0_spawn = false;
-    while (still_running_1_spawn == true)
-    {
-    }
-    still_running_1_spawn = true;
-
-    // Initialize boolean for tracking every other cycle
-    bool second_cycle = false;
+    frame_N_boids = curr_N_boids;
+    PT_BARRIER_WAIT(pt, &barrier_spawn);
 
     while (1)
     {
         // Measure time at start of thread
         begin_time_0 = time_us_32();
-        uint16_t current_boid_1 = curr_N_boids - 1;
 
-        for (uint16_t current_boid_0 = 0; current_boid_0 < half_N_boids; current_boid_0++)
+        // Clear this core's neighbor sums from the last frame, and core 1's
+        // for any boids added after it cleared the planned count
+        memset(scratch[0], 0, curr_N_boids * sizeof(struct boid_accum));
+        if (curr_N_boids > frame_N_boids)
         {
-            // update boid's position and velocity
-            boid_algo_init_calc_core0(current_boid_0, current_boid_1, second_cycle);
-            current_boid_1--;
+            memset(&scratch[1][frame_N_boids], 0, (curr_N_boids - frame_N_boids) * sizeof(struct boid_accum));
         }
 
-        // Toggle every other cycle flag
-        second_cycle = !second_cycle;
+        // Sort the boids into the grid and cut the search into chunks,
+        // then let core 1 start claiming them
+        search_prepare();
+        work_plan();
+        pt_barrier_spin(&barrier_search);
+
+        // Search chunks until both cores have run out
+        work_run(0);
 
         // Wait until core 1 has finished updating
-        still_running_0_current_update = false;
-        while (still_running_1_current_update == true)
-        {
-        }
-        still_running_1_current_update = true;
+        pt_barrier_spin(&barrier_update);
 
         for (uint16_t current_boid_0 = 0; current_boid_0 < half_N_boids; current_boid_0++)
         {
             // Erase boid
-            drawPixel(fix2int15(boids[current_boid_0].x), fix2int15(boids[current_boid_0].y), BLACK);
+            drawPixel(fix2int15(BOID_X(current_boid_0)), fix2int15(BOID_Y(current_boid_0)), BLACK);
 
             // Update boid state
             boid_algo_update(current_boid_0);
 
             // Draw the boid at its new position
-            drawPixel(fix2int15(boids[current_boid_0].x), fix2int15(boids[current_boid_0].y), WHITE);
-
-            // Set all values needed for boid calculate back to 0
-            boids[current_boid_0].xpos_avg_0 = 0;
-            boids[current_boid_0].ypos_avg_0 = 0;
-            boids[current_boid_0].xvel_avg_0 = 0;
-            boids[current_boid_0].yvel_avg_0 = 0;
-            boids[current_boid_0].neighboring_boids_0 = 0;
-            boids[current_boid_0].close_dx_0 = 0;
-            boids[current_boid_0].close_dy_0 = 0;
-            boids[current_boid_0].close_dy_0 = 0;
-            boids[current_boid_0].xpos_avg_1 = 0;
-            boids[current_boid_0].ypos_avg_1 = 0;
-            boids[current_boid_0].xvel_avg_1 = 0;
-            boids[current_boid_0].yvel_avg_1 = 0;
-            boids[current_boid_0].neighboring_boids_1 = 0;
-            boids[current_boid_0].close_dx_1 = 0;
-            boids[current_boid_0].close_dy_1 = 0;
-            boids[current_boid_0].num_predators = 0;
-            boids[current_boid_0].predator_dx = 0;
-            boids[current_boid_0].predator_dy = 0;
+            drawPixel(fix2int15(BOID_X(current_boid_0)), fix2int15(BOID_Y(current_boid_0)), WHITE);
         }
 
         // Wait until core 1 to finish drawing
-        still_running_0_draw = false;
-        while (still_running_1_draw == true)
-        {
-        }
-        still_running_1_draw = true;
+        pt_barrier_spin(&barrier_draw);
 
         for (uint8_t current_predator = 0; current_predator < curr_N_predators; current_predator++)
         {
@@ -899,6 +740,7 @@ static PT_THREAD(protothread_anim(struct pt *pt))
             // Draw the predator at its new position
             drawRect(fix2int15(predators[current_predator].x), fix2int15(predators[current_predator].y), 2, 2, RED);
         }
+        sim_frame++;
 
         // Draw the boundaries
         drawArena(should_draw);
@@ -910,40 +752,38 @@ static PT_THREAD(protothread_anim(struct pt *pt))
             // Display text on VGA display: Number of boids, frame rate, time elapsed
 
             total_time_0 = time_us_32() / 1000000;
-            sprintf(str1, "Time=%d", total_time_0);
-            sprintf(str2, "Spare Time=%d", spare_time_0);
-            sprintf(str4, "Boids=%d", curr_N_boids);
-
-            fillRect(0, 0, 150, 70, BLACK);
-            setCursor(10, 10);
-            setTextColor(WHITE);
-            setTextSize(1);
-            writeString(str1);
-
-            setCursor(10, 25);
-            setTextColor(WHITE);
-            setTextSize(1);
-            writeString(str2);
-
-            setCursor(10, 40);
-            setTextColor(WHITE);
-            setTextSize(1);
-            writeString(str4);
+            snprintf(hud[0], sizeof(hud[0]), "Time=%d", total_time_0);
+            snprintf(hud[1], sizeof(hud[1]), "Spare Time=%d", spare_time_0);
+            snprintf(hud[2], sizeof(hud[2]), "Boids=%d", curr_N_boids);
+            snprintf(hud[3], sizeof(hud[3]), "Dropped=%u", frames_0.overruns);
+            snprintf(hud[4], sizeof(hud[4]), "Busy=%u/%uus", (unsigned int)work_busy_us[0], (unsigned int)work_busy_us[1]);
+            snprintf(hud[5], sizeof(hud[5]), "Latency=%uus", (unsigned int)frame_latency_us);
+            drawHud(hud);
 
             counter_0 = 0;
         }
 
         counter_0++;
 
-        // Yield for necessary amount of time
-        PT_YIELD_usec(spare_time_0);
+        // Yield until this frame's vblank
+        PT_YIELD_VBLANK(pt, &frames_0, FRAME_VBLANKS);
+        frame_latency_us = time_us_32() - begin_time_0;
 
-        // Wait for core 1 to complete
-        still_running_0_string_output = false;
-        while (still_running_1_string_output == true)
+        // Grow or shrink the flock to hold the frame slack at the margin.
+        // Core 1 does not touch the flock until the frame barrier.
+        if (governor_on)
         {
+            uint16_t n = governor_update(frames_0.busy_us, frames_0.overruns);
+            for (uint16_t i = n; i < curr_N_boids; i++)
+            {
+                drawPixel(fix2int15(BOID_X(i)), fix2int15(BOID_Y(i)), BLACK);
+            }
+            flock_resize(n);
         }
-        still_running_1_string_output = true;
+
+        // Wait for core 1 to complete
+        frame_N_boids = curr_N_boids;
+        PT_BARRIER_WAIT(pt, &barrier_frame);
         // NEVER exit while
     } // END WHILE(1)
     PT_END(pt);
@@ -958,105 +798,248 @@ static PT_THREAD(protothread_anim1(struct pt *pt))
     // Mark beginning of thread
     PT_BEGIN(pt);
 
-    // Variables for maintaining frame rate
-    static int begin_time_1;
-    static int spare_time_1;
-
-    // Spawn second half of boid flock
-    for (uint16_t current_boid_1 = curr_N_boids - 1; current_boid_1 > half_N_boids - 1; current_boid_1--)
-    {
-        spawn(&boids[current_boid_1].x, &boids[current_boid_1].y, &boids[current_boid_1].vx, &boids[current_boid_1].vy);
-    }
-
-    // Wait for
-    still_running_1_spawn = false;
-    while (still_running_0_spawn == true)
-    {
-    }
-    still_running_0_spawn = true;
-
-    bool second_cycle = false;
+    // Wait for core 0 to spawn the flock
+    pt_barrier_spin(&barrier_spawn);
 
     while (1)
     {
-        // Measure time at start of thread
-        begin_time_1 = time_us_32();
+        // Clear this core's neighbor sums from the last frame
+        memset(scratch[1], 0, frame_N_boids * sizeof(struct boid_accum));
 
-        uint16_t current_boid_0 = 0;
-        for (uint16_t current_boid_1 = curr_N_boids - 1; current_boid_1 > half_N_boids - 1; current_boid_1--)
-        {
-            // Update boid's position and velocity
-            boid_algo_init_calc_core1(current_boid_0, current_boid_1, second_cycle);
-            current_boid_0++;
-        }
+        // Wait for core 0 to sort the boids and cut the search into chunks
+        pt_barrier_spin(&barrier_search);
 
-        // Toggle every other cycle flag
-        second_cycle = !second_cycle;
+        // Search chunks until both cores have run out
+        work_run(1);
 
         // Wait until core 0 has finished updating
-        still_running_1_current_update = false;
-        while (still_running_0_current_update == true)
-        {
-        }
-        still_running_0_current_update = true;
+        pt_barrier_spin(&barrier_update);
 
         for (uint16_t current_boid_1 = curr_N_boids - 1; current_boid_1 > half_N_boids - 1; current_boid_1--)
         {
             // Erase boid
-            drawPixel(fix2int15(boids[current_boid_1].x), fix2int15(boids[current_boid_1].y), BLACK);
+            drawPixel(fix2int15(BOID_X(current_boid_1)), fix2int15(BOID_Y(current_boid_1)), BLACK);
 
             // Update boid state
             boid_algo_update(current_boid_1);
 
             // Draw the boid at its new position
-            drawPixel(fix2int15(boids[current_boid_1].x), fix2int15(boids[current_boid_1].y), WHITE);
-
-            // Set all values needed for boid calculate back to 0
-            boids[current_boid_1].xpos_avg_0 = 0;
-            boids[current_boid_1].ypos_avg_0 = 0;
-            boids[current_boid_1].xvel_avg_0 = 0;
-            boids[current_boid_1].yvel_avg_0 = 0;
-            boids[current_boid_1].neighboring_boids_0 = 0;
-            boids[current_boid_1].close_dx_0 = 0;
-            boids[current_boid_1].close_dy_0 = 0;
-            boids[current_boid_1].xpos_avg_1 = 0;
-            boids[current_boid_1].ypos_avg_1 = 0;
-            boids[current_boid_1].xvel_avg_1 = 0;
-            boids[current_boid_1].yvel_avg_1 = 0;
-            boids[current_boid_1].neighboring_boids_1 = 0;
-            boids[current_boid_1].close_dx_1 = 0;
-            boids[current_boid_1].close_dy_1 = 0;
-            boids[current_boid_1].num_predators = 0;
-            boids[current_boid_1].predator_dx = 0;
-            boids[current_boid_1].predator_dy = 0;
+            drawPixel(fix2int15(BOID_X(current_boid_1)), fix2int15(BOID_Y(current_boid_1)), WHITE);
         }
 
         // Wait for core 0 to stop drawing
-        still_running_1_draw = false;
-        while (still_running_0_draw == true)
+        pt_barrier_spin(&barrier_draw);
+
+        // Draw the boundaries
+        drawArena(should_draw);
+
+        // Yield until this frame's vblank
+        PT_YIELD_VBLANK(pt, &frames_1, FRAME_VBLANKS);
+
+        // Wait for core 0 to complete
+        pt_barrier_spin(&barrier_frame);
+        // NEVER exit while
+    } // END WHILE(1)
+
+    PT_END(pt);
+} // animation thread
+
+#else // PIPELINE
+
+// Render thread on core 0: erases and draws the frames core 1 publishes
+static PT_THREAD(protothread_anim(struct pt *pt))
+{
+    // Mark beginning of thread
+    PT_BEGIN(pt);
+
+    // Variables for maintaining frame rate
+    static int begin_time_0;
+    static int spare_time_0;
+    static int total_time_0 = 0;
+    static int counter_0 = 0;
+    static uint32_t drawn = 0; // last frame on screen
+    static struct pipe_slot *shown;
+    char hud[HUD_LINES][20];
+
+    while (1)
+    {
+        // Wait for the next simulated frame
+        PT_YIELD_UNTIL(pt, pipe_published != drawn);
+        __dmb();
+        begin_time_0 = time_us_32();
+
+        // Erase the frame on screen, then hand its slot back to core 1
+        if (drawn > 0)
         {
+            for (uint16_t i = 0; i < shown->n_boids; i++)
+            {
+                drawPixel(PIPE_X(shown->boid_xy[i]), PIPE_Y(shown->boid_xy[i]), BLACK);
+            }
+            for (uint8_t l = 0; l < shown->n_predators; l++)
+            {
+                drawRect(PIPE_X(shown->predator_xy[l]), PIPE_Y(shown->predator_xy[l]), 2, 2, BLACK);
+            }
+        }
+        __dmb();
+        pipe_released = drawn;
+
+        // Draw the new frame
+        drawn++;
+        shown = &pipe_slots[drawn & 1];
+        for (uint16_t i = 0; i < shown->n_boids; i++)
+        {
+            drawPixel(PIPE_X(shown->boid_xy[i]), PIPE_Y(shown->boid_xy[i]), WHITE);
+        }
+        for (uint8_t l = 0; l < shown->n_predators; l++)
+        {
+            drawRect(PIPE_X(shown->predator_xy[l]), PIPE_Y(shown->predator_xy[l]), 2, 2, RED);
         }
-        still_running_0_draw = true;
 
         // Draw the boundaries
         drawArena(should_draw);
 
-        spare_time_1 = FRAME_RATE - (time_us_32() - begin_time_1);
+        if (counter_0 > 30)
+        {
+            spare_time_0 = FRAME_RATE - (time_us_32() - begin_time_0);
 
-        // Yield for necessary amount of time
-        PT_YIELD_usec(spare_time_1);
+            // Display text on VGA display: Number of boids, frame rate, time elapsed
+            total_time_0 = time_us_32() / 1000000;
+            snprintf(hud[0], sizeof(hud[0]), "Time=%d", total_time_0);
+            snprintf(hud[1], sizeof(hud[1]), "Spare Time=%d", spare_time_0);
+            snprintf(hud[2], sizeof(hud[2]), "Boids=%d", shown->n_boids);
+            snprintf(hud[3], sizeof(hud[3]), "Dropped=%u", frames_0.overruns);
+            snprintf(hud[4], sizeof(hud[4]), "Busy=%u/%uus", (unsigned int)work_busy_us[0], (unsigned int)work_busy_us[1]);
+            snprintf(hud[5], sizeof(hud[5]), "Latency=%uus", (unsigned int)frame_latency_us);
+            drawHud(hud);
 
-        // Wait for core 0 to complete
-        still_running_1_string_output = false;
-        while (still_running_0_string_output == true)
+            counter_0 = 0;
+        }
+
+        counter_0++;
+
+        // Help with the next frame's neighbor search, if it is still open
+        pipe_helping = true;
+        __dmb();
+        if (pipe_search_open)
+        {
+            work_run(0);
+        }
+        else
         {
+            work_busy_us[0] = 0;
         }
-        still_running_0_string_output = true;
+        pipe_helping = false;
+
+        // Yield until this frame's vblank
+        PT_YIELD_VBLANK(pt, &frames_0, FRAME_VBLANKS);
+        frame_latency_us = time_us_32() - shown->begin_time;
+        // NEVER exit while
+    } // END WHILE(1)
+    PT_END(pt);
+} // render thread
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Simulation thread on core 1: computes each frame alone, then publishes it
+static PT_THREAD(protothread_anim1(struct pt *pt))
+{
+    // Mark beginning of thread
+    PT_BEGIN(pt);
+
+    static uint32_t frame = 0; // last frame published
+
+    // Spawn the whole flock and the predators
+    for (uint16_t i = 0; i < curr_N_boids; i++)
+    {
+        boid_spawn(i);
+    }
+    for (uint8_t l = 0; l < curr_N_predators; l++)
+    {
+        spawn(&predators[l].x, &predators[l].y, &predators[l].vx, &predators[l].vy);
+    }
+
+    while (1)
+    {
+        // Let the serial thread change the flock between frames
+        if (pipe_hold)
+        {
+            pipe_held = true;
+            while (pipe_hold)
+            {
+            }
+            pipe_held = false;
+        }
+
+        // Grow or shrink the flock to hold the slack of the slower core at
+        // the margin. Core 0 erases retired boids with the frame they were in.
+        if (governor_on)
+        {
+            uint32_t busy_us = frames_0.busy_us > pipe_sim_us ? frames_0.busy_us : pipe_sim_us;
+            flock_resize(governor_update(busy_us, frames_0.overruns));
+        }
+
+        uint32_t begin_time_1 = time_us_32();
+
+        // Plan the neighbor search and open it to core 0. Core 0 is not in
+        // the search here, so both arenas can be cleared.
+        memset(scratch[0], 0, curr_N_boids * sizeof(struct boid_accum));
+        memset(scratch[1], 0, curr_N_boids * sizeof(struct boid_accum));
+        search_prepare();
+        work_plan();
+        __dmb();
+        pipe_search_open = true;
+        work_run(1);
+
+        // Close the search and wait for core 0 to finish its last chunk
+        pipe_search_open = false;
+        __dmb();
+        while (pipe_helping)
+        {
+        }
+
+        // Update every boid and predator
+
+        for (uint16_t i = 0; i < curr_N_boids; i++)
+        {
+            boid_algo_update(i);
+        }
+        for (uint8_t l = 0; l < curr_N_predators; l++)
+        {
+            predator_algo(l);
+        }
+        sim_frame++;
+        pipe_sim_us = time_us_32() - begin_time_1;
+
+        // Wait until core 0 has erased the frame that last used this slot
+        frame++;
+        while (pipe_released + 2 < frame)
+        {
+        }
+
+        struct pipe_slot *slot = &pipe_slots[frame & 1];
+        for (uint16_t i = 0; i < curr_N_boids; i++)
+        {
+            slot->boid_xy[i] = PIPE_XY(fix2int15(BOID_X(i)), fix2int15(BOID_Y(i)));
+        }
+        for (uint8_t l = 0; l < curr_N_predators; l++)
+        {
+            slot->predator_xy[l] = PIPE_XY(fix2int15(predators[l].x), fix2int15(predators[l].y));
+        }
+        slot->n_boids = curr_N_boids;
+        slot->n_predators = curr_N_predators;
+        slot->begin_time = begin_time_1;
+
+        // Publish the slot only once it is all written
+        __dmb();
+        pipe_published = frame;
         // NEVER exit while
     } // END WHILE(1)
 
     PT_END(pt);
-} // animation thread
+} // simulation thread
+
+#endif // PIPELINE
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1081,10 +1064,28 @@ int main()
     set_sys_clock_khz(250000, true);
     // initialize stio
     stdio_init_all();
+    // USB port carries only captured frames
+    vgaCaptureInit();
 
     // initialize VGA
     initVGA();
 
+    // reciprocals for averaging the neighbor sums
+    recip_init();
+
+    // spinlock guarding the neighbor search claim counter
+    work_init();
+
+    // arena walls for the boids to steer by
+    ofield_bake();
+
+    // barriers between the cores, before core 1 starts
+    PT_BARRIER_INIT(&barrier_spawn, BARRIER_LOCK);
+    PT_BARRIER_INIT(&barrier_search, BARRIER_LOCK);
+    PT_BARRIER_INIT(&barrier_update, BARRIER_LOCK);
+    PT_BARRIER_INIT(&barrier_draw, BARRIER_LOCK);
+    PT_BARRIER_INIT(&barrier_frame, BARRIER_LOCK);
+
     // Map LED to GPIO port, make it low
     //   gpio_init(LED);
     //   gpio_set_dir(LED, GPIO_OUT);
@@ -1097,6 +1098,9 @@ int main()
     // add threads
     pt_add_thread(protothread_serial);
     pt_add_thread(protothread_anim);
+#if VGA_CONSOLE != VGA_CONSOLE_ONLY
+    pt_add_thread(protothread_capture);
+#endif
 
     // start scheduler
     pt_schedule_start;
@@ -0,0 +1,182 @@
+/**
+ * Headless host runner for the boids kernel
+ *
+ * Runs boids_kernel.c on a PC with no display. It spawns a seeded flock,
+ * steps it frame by frame exactly as boids5 does, and prints:
+ *  - a state checksum (same hash as the "checksum" serial command)
+ *  - flock metrics: speed, alignment and cohesion
+ *  - kernel time per frame and per boid
+ *
+ * BUILD
+ *   cc -O2 -DBOIDS_HOST -o boids_headless boids_headless.c boids_kernel.c -lm
+ * Add e.g. -DN_boids=2000 for bigger flocks than fit on the RP2040.
+ *
+ * USAGE
+ *   ./boids_headless [-n boids] [-f frames] [-s seed] [-a arena] [-p predators]
+ *                    [-v visualrange] [-m search] [-e 0|1] [-o 0|1] [-k report interval]
+ *   arena: 0 = wrap everywhere, 1 = box (default), 2 = two vertical lines
+ *   search: 0 = all pairs, 1 = grid (default), 2 = sweep and prune
+ *   -e 0 checks every predator for every boid instead of the predator field
+ *   -o 0 checks the arena walls one by one instead of the obstacle field
+ *   seed 0 is the flock boids5 spawns at boot
+ *
+ * To compare with the RP2040, type "seed <s>" on the serial console (with
+ * the same number of boids, predators and arena), wait, then "checksum";
+ * run this with -f set to the frame it prints. "seed" turns the flock size
+ * governor off, since this runner doesn't model it; set the flock size
+ * with "numberBoids" (which also turns it off) before seeding.
+ */
+
+#include "boids_kernel.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *search_names[] = {"pair", "grid", "sweep"};
+
+static double now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+// Speed, alignment and cohesion of the flock, from the neighbor sums of the
+// last search (so call between the search and the update)
+static void report(uint32_t frame)
+{
+    double speed_sum = 0, speed_min = 1e9, speed_max = 0;
+    double vx_sum = 0, vy_sum = 0;
+    double offset_sum = 0, neighbors_sum = 0;
+    uint16_t with_neighbors = 0;
+
+    for (uint16_t i = 0; i < curr_N_boids; i++)
+    {
+        double vx = fix2float15(BOID_VX(i));
+        double vy = fix2float15(BOID_VY(i));
+        double speed = sqrt(vx * vx + vy * vy);
+        speed_sum += speed;
+        if (speed < speed_min) speed_min = speed;
+        if (speed > speed_max) speed_max = speed;
+        vx_sum += vx;
+        vy_sum += vy;
+
+        // Distance to the center of the boids in visual range
+        struct boid_accum *a = &scratch[0][i];
+        uint16_t n = a->neighboring_boids;
+        if (n > 0)
+        {
+            double dx = fix2float15(a->xpos_sum) / n;
+            double dy = fix2float15(a->ypos_sum) / n;
+            offset_sum += sqrt(dx * dx + dy * dy);
+            neighbors_sum += n;
+            with_neighbors++;
+        }
+    }
+
+    // Alignment: length of the summed velocity over the summed speeds
+    // (1 = all boids heading the same way, near 0 = random headings)
+    double alignment = speed_sum > 0 ? sqrt(vx_sum * vx_sum + vy_sum * vy_sum) / speed_sum : 0;
+
+    printf("frame %5u  checksum %08x  speed %.2f [%.2f, %.2f]  alignment %.3f  "
+           "cohesion %.2f px  neighbors %.1f  alone %u\n",
+           frame, boid_checksum(), speed_sum / curr_N_boids, speed_min, speed_max, alignment,
+           with_neighbors ? offset_sum / with_neighbors : 0.0,
+           with_neighbors ? neighbors_sum / with_neighbors : 0.0,
+           curr_N_boids - with_neighbors);
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t n = N_boids;
+    uint32_t frames = 600;
+    uint32_t seed = 0;
+    uint32_t interval = 60;
+    int range = 40;
+
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        int value = atoi(argv[a + 1]);
+        if (strcmp(argv[a], "-n") == 0) n = value;
+        else if (strcmp(argv[a], "-f") == 0) frames = value;
+        else if (strcmp(argv[a], "-s") == 0) seed = value;
+        else if (strcmp(argv[a], "-a") == 0) should_draw = value;
+        else if (strcmp(argv[a], "-p") == 0) curr_N_predators = value;
+        else if (strcmp(argv[a], "-v") == 0) range = value;
+        else if (strcmp(argv[a], "-m") == 0) search_mode = value;
+        else if (strcmp(argv[a], "-e") == 0) use_pfield = value;
+        else if (strcmp(argv[a], "-o") == 0) use_ofield = value;
+        else if (strcmp(argv[a], "-k") == 0) interval = value;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[a]);
+            return 1;
+        }
+    }
+    if (n > N_boids) n = N_boids;
+    if (curr_N_predators > N_predators) curr_N_predators = N_predators;
+    if (search_mode > SEARCH_SWEEP) search_mode = SEARCH_GRID;
+    if (interval == 0) interval = 1;
+    curr_N_boids = n;
+    half_N_boids = n >> 1;
+    visualRange = int2fix15(range);
+
+    // Same start-up as boids5: tables and walls, then the flock, then the predators
+    recip_init();
+    work_init();
+    ofield_bake();
+    boid_seed(seed);
+    for (uint16_t i = 0; i < curr_N_boids; i++)
+    {
+        boid_spawn(i);
+    }
+    for (uint8_t l = 0; l < curr_N_predators; l++)
+    {
+        spawn(&predators[l].x, &predators[l].y, &predators[l].vx, &predators[l].vy);
+    }
+
+    printf("%u boids, %u predators, arena %u, visual range %d, %s search, seed %u\n",
+           curr_N_boids, curr_N_predators, should_draw, range, search_names[search_mode], seed);
+
+    double search_us = 0, update_us = 0;
+    for (uint32_t frame = 1; frame <= frames; frame++)
+    {
+        // Neighbor search, all on one core
+        double t0 = now_us();
+        memset(scratch, 0, sizeof(scratch));
+        search_prepare();
+        work_plan();
+        work_run(0);
+        double t1 = now_us();
+
+        // Metrics describe the state this frame's update starts from
+        if (frame % interval == 0)
+        {
+            report(frame - 1);
+        }
+
+        // Update, boids then predators
+        double t2 = now_us();
+        for (uint16_t i = 0; i < curr_N_boids; i++)
+        {
+            boid_algo_update(i);
+        }
+        for (uint8_t l = 0; l < curr_N_predators; l++)
+        {
+            predator_algo(l);
+        }
+        double t3 = now_us();
+
+        search_us += t1 - t0;
+        update_us += t3 - t2;
+    }
+
+    printf("frame %5u  checksum %08x\n", frames, boid_checksum());
+    if (frames > 0)
+    {
+        printf("kernel per frame: search %.1f us, update %.1f us (%.1f ns per boid)\n",
+               search_us / frames, update_us / frames,
+               1000.0 * (search_us + update_us) / frames / (curr_N_boids ? curr_N_boids : 1));
+    }
+    return 0;
+}
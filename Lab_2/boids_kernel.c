@@ -0,0 +1,1333 @@
+/**
+ * Boids simulation kernel, see boids_kernel.h
+ *
+ * Code adapted from Hunter Adams (vha3@cornell.edu)
+ */
+
+#include "boids_kernel.h"
+#include <string.h>
+
+#ifdef BOIDS_HOST
+#include <time.h>
+// Host build: a microsecond clock, and one core so the claim counter needs no lock
+static inline uint32_t time_us_32()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)(t.tv_sec * 1000000u + t.tv_nsec / 1000);
+}
+typedef int spin_lock_t;
+#define spin_lock_init(n) ((spin_lock_t *)0)
+#define spin_lock_unsafe_blocking(l)
+#define spin_unlock_unsafe(l)
+#else
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#endif
+
+// Reciprocals of neighbor counts, see divcount()
+uint32_t recip_table[RECIP_MAX + 1];
+
+// Initializing boids
+uint16_t curr_N_boids = 1209; // Current # of boids
+uint16_t half_N_boids = 604;
+
+// Boid state, one array per field so that each loop reads only what it uses
+#if BOID_PACKED
+uint32_t boid_pos[N_boids];
+uint32_t boid_vel[N_boids];
+#else
+fix15 boid_x[N_boids];
+fix15 boid_y[N_boids];
+fix15 boid_vx[N_boids];
+fix15 boid_vy[N_boids];
+#endif
+
+// Per-frame scratch arena: one set of neighbor sums per core, so the cores
+// never write the same memory. Each core clears its own set with one memset
+// at the start of every frame.
+struct boid_accum scratch[2][N_boids];
+
+// Initializing boid parameters
+fix15 turnfactor = float2fix15(0.2);
+fix15 visualRange = int2fix15(40);
+fix15 protectedRange = int2fix15(8);
+fix15 centeringfactor = float2fix15(0.0005);
+fix15 avoidfactor = float2fix15(0.05);
+fix15 matchingfactor = float2fix15(0.05);
+fix15 maxspeed = int2fix15(4);
+fix15 minspeed = int2fix15(2);
+
+// Initializing predator s
+uint8_t curr_N_predators = 0; // Current # of predators
+struct predator predators[N_predators];
+
+// Initializing predator parameters
+fix15 predatory_range = int2fix15(50);
+fix15 predator_turnfactor = float2fix15(0.5);
+
+// Predator field: each frame every predator sets its bit in the cells its
+// predatory range overlaps, so a boid only checks the predators whose bits
+// are set in its own cell instead of looping over all of them
+#define PFIELD_SHIFT 5 // 32 pixel cells
+#define PFIELD_COLS (640 >> PFIELD_SHIFT)
+#define PFIELD_ROWS (480 >> PFIELD_SHIFT)
+uint32_t pfield[PFIELD_ROWS][PFIELD_COLS];
+bool use_pfield = true;
+
+// Obstacle field: the arena walls and the obstacles baked into a coarse
+// signed distance map whenever they change. Each cell holds the distance
+// from its center to the nearest wall (negative inside one) and the unit
+// direction away from it, so a boid steers with one lookup however many
+// obstacles there are.
+#define OFIELD_SHIFT 4 // 16 pixel cells
+#define OFIELD_COLS (640 >> OFIELD_SHIFT)
+#define OFIELD_ROWS (480 >> OFIELD_SHIFT)
+#define OFIELD_HALF (1 << (OFIELD_SHIFT - 1))
+#define OFIELD_UNIT_SHIFT 6 // gradient components are 1/64ths
+#define OFIELD_FAR 127      // distance stored for cells with no wall near
+struct ofield_cell
+{
+    int8_t d;  // distance from the cell center to the nearest wall (pixels)
+    int8_t gx; // direction away from that wall
+    int8_t gy;
+};
+struct ofield_cell ofield[OFIELD_ROWS][OFIELD_COLS];
+bool use_ofield = true;
+int16_t ofield_range = 0; // turn when closer than this to a wall (pixels)
+struct obstacle obstacles[OBSTACLES_MAX];
+uint8_t n_obstacles = 0;
+
+// Uniform grid for the neighbor search. Cells are at least visualRange
+// wide, so every neighbor of a boid is in its own cell or one of the 8
+// around it. Rebuilt every frame by a counting sort of the boids.
+#define GRID_MAX_COLS 32
+#define GRID_MAX_ROWS 24
+uint8_t search_mode = SEARCH_GRID;
+uint16_t grid_start[GRID_MAX_COLS * GRID_MAX_ROWS + 1]; // first entry of each cell in grid_index
+uint16_t grid_index[N_boids];                           // boid indices sorted by cell
+uint8_t grid_cols = 1;
+uint8_t grid_rows = 1;
+uint16_t grid_cell_w = 640;
+uint16_t grid_cell_h = 480;
+bool grid_wrap_x = false;   // wrap-around arena: neighbors across the left/right edge
+bool grid_wrap_y = false;   // neighbors across the top/bottom edge
+
+// Sweep and prune neighbor search. The boids stay sorted by x from one
+// frame to the next, so the insertion sort only moves the few that passed
+// each other, then each boid is compared with the boids ahead of it up to
+// visualRange further in x.
+uint16_t sweep_index[N_boids];  // boid indices sorted by x
+int16_t sweep_key[N_boids];     // x in whole pixels of each entry
+static uint16_t sweep_n = 0;    // boids in sweep_index
+static int16_t sweep_range;     // visualRange rounded up to whole pixels
+static int16_t sweep_width;     // arena width if it wraps left/right, else 0
+
+// Work scheduler for the neighbor search. Core 0 cuts the frame's work
+// (grid cells, or boid rows of the pair loop) into chunks of about equal
+// cost, then both cores claim chunks through a counter guarded by a
+// hardware spinlock until none are left, each into its own neighbor sums.
+#define WORK_CHUNKS 32
+#define WORK_LOCK 26                     // hardware spinlock number
+uint16_t work_start[WORK_CHUNKS + 1];    // first cell or boid row of each chunk
+uint8_t work_chunks = 0;                 // chunks this frame
+volatile uint8_t work_next = 0;          // next chunk to hand out
+static spin_lock_t *work_lock;
+bool work_cross = false;                 // pair loop: pairs across the halves this frame
+volatile uint32_t work_busy_us[2];       // each core's neighbor search time, last frame
+volatile uint8_t work_claimed[2];        // chunks each core took, last frame
+
+// Margin Size
+uint16_t x_margin_left_box = 100;
+uint16_t x_margin_right_box = 540;
+uint16_t x_change_margin_box = 440;
+uint16_t y_margin_top_box = 100;
+uint16_t y_margin_bottom_box = 380;
+uint16_t y_change_margin_box = 280;
+uint8_t should_draw = 1;
+
+// Vertical Line Size
+uint16_t x_margin_left_V_line = 200;
+uint16_t x_margin_right_V_line = 440;
+uint16_t y_margin_top_line = 0;
+uint16_t y_change_margin_line = 480;
+
+// Screen Size
+uint16_t y_screen_top = 0;
+uint16_t y_screen_bottom = 480;
+uint16_t x_screen_left = 0;
+uint16_t x_screen_right = 640;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Fill the reciprocal table, rounded to nearest
+void recip_init()
+{
+    recip_table[0] = 0;
+    for (uint16_t n = 1; n <= RECIP_MAX; n++)
+    {
+        recip_table[n] = ((1u << RECIP_SHIFT) + (n >> 1)) / n;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Pseudo-random numbers for spawning (xorshift32), so that a seed gives
+// the same flock on the RP2040 and on a host
+static uint32_t boid_rand_state = 2463534242u;
+
+void boid_seed(uint32_t seed)
+{
+    boid_rand_state = seed ? seed : 2463534242u;
+}
+
+static inline uint32_t boid_rand()
+{
+    boid_rand_state ^= boid_rand_state << 13;
+    boid_rand_state ^= boid_rand_state >> 17;
+    boid_rand_state ^= boid_rand_state << 5;
+    return boid_rand_state;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Spawn boid or predator by assigning its position and velocity
+void spawn(fix15 *x, fix15 *y, fix15 *vx, fix15 *vy)
+{
+    *x = int2fix15(boid_rand() % 640);
+    *y = int2fix15(boid_rand() % 480);
+    *vx = int2fix15(boid_rand() % 3 + 3);
+    *vy = int2fix15(boid_rand() % 3 + 3);
+}
+
+// Spawn boid i, in whichever layout the state is kept
+void boid_spawn(uint16_t i)
+{
+    fix15 x, y, vx, vy;
+    spawn(&x, &y, &vx, &vy);
+    boid_store(i, x, y, vx, vy);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Grow the flock to n boids by spawning new ones at the end of the arrays,
+// or shrink it by retiring the last ones. Boids already flying are left
+// alone. Call between frames.
+void flock_resize(uint16_t n)
+{
+    if (n > N_boids)
+    {
+        n = N_boids;
+    }
+    for (uint16_t i = curr_N_boids; i < n; i++)
+    {
+        boid_spawn(i);
+    }
+    curr_N_boids = n;
+    half_N_boids = n >> 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Grid cell of boid i. Boids just past a wrapped edge (they wrap on their
+// next update) go in the cell they will wrap into, others in the edge cell.
+static inline uint16_t grid_cell_of(uint16_t i)
+{
+    int x = fix2int15(BOID_X(i));
+    int y = fix2int15(BOID_Y(i));
+    if (grid_wrap_x)
+    {
+        if (x < 0) x += x_screen_right;
+        else if (x >= x_screen_right) x -= x_screen_right;
+    }
+    if (grid_wrap_y)
+    {
+        if (y < 0) y += y_screen_bottom;
+        else if (y >= y_screen_bottom) y -= y_screen_bottom;
+    }
+    int cx = x / grid_cell_w;
+    int cy = y / grid_cell_h;
+    if (cx < 0) cx = 0;
+    if (cx >= grid_cols) cx = grid_cols - 1;
+    if (cy < 0) cy = 0;
+    if (cy >= grid_rows) cy = grid_rows - 1;
+    return cy * grid_cols + cx;
+}
+
+// Sort the boids into grid cells, sized from the current visualRange and arena
+void grid_build()
+{
+    int range = fix2int15(visualRange);
+    if (range < 1)
+    {
+        range = 1;
+    }
+
+    // The arena wraps left/right with no walls, and top/bottom unless there is a box
+    grid_wrap_x = (should_draw == 0);
+    grid_wrap_y = (should_draw != 1);
+
+    // Round the cell count down so cells are never narrower than visualRange.
+    // A wrapped axis needs 3 cells, or the cells on either side are the same cell.
+    int cols = x_screen_right / range;
+    int rows = y_screen_bottom / range;
+    if (cols > GRID_MAX_COLS)
+    {
+        cols = GRID_MAX_COLS;
+    }
+    if (rows > GRID_MAX_ROWS)
+    {
+        rows = GRID_MAX_ROWS;
+    }
+    if (cols < 1 || (grid_wrap_x && cols < 3))
+    {
+        cols = 1;
+    }
+    if (rows < 1 || (grid_wrap_y && rows < 3))
+    {
+        rows = 1;
+    }
+    grid_cols = cols;
+    grid_rows = rows;
+    grid_cell_w = x_screen_right / cols;
+    grid_cell_h = y_screen_bottom / rows;
+
+    // Counting sort: count each cell, turn counts into cell ends, then
+    // place boids back to front so each cell ends up at its start
+    uint16_t n_cells = cols * rows;
+    memset(grid_start, 0, (n_cells + 1) * sizeof(grid_start[0]));
+    for (uint16_t i = 0; i < curr_N_boids; i++)
+    {
+        grid_start[grid_cell_of(i)]++;
+    }
+    for (uint16_t c = 1; c < n_cells; c++)
+    {
+        grid_start[c] += grid_start[c - 1];
+    }
+    for (int i = curr_N_boids - 1; i >= 0; i--)
+    {
+        grid_index[--grid_start[grid_cell_of(i)]] = i;
+    }
+    grid_start[n_cells] = curr_N_boids;
+}
+
+// Accumulate the pair (i, j) into one core's neighbor sums. dx/dy point
+// from j to i, across the wrapped edge if that is shorter, so the offsets
+// are to where each boid appears to be from the other.
+static inline void accumulate_pair(struct boid_accum *acc, uint16_t i, uint16_t j, fix15 dx, fix15 dy)
+{
+    // Are both those differences less than the protected range?
+    if (absfix15(dx) < protectedRange && absfix15(dy) < protectedRange)
+    {
+        acc[i].close_dx += dx;
+        acc[i].close_dy += dy;
+        acc[j].close_dx -= dx;
+        acc[j].close_dy -= dy;
+    }
+    else // Boid is in the visual range
+    {
+        acc[i].xpos_sum -= dx;
+        acc[i].ypos_sum -= dy;
+        acc[i].xvel_sum += BOID_VX(j);
+        acc[i].yvel_sum += BOID_VY(j);
+        acc[j].xpos_sum += dx;
+        acc[j].ypos_sum += dy;
+        acc[j].xvel_sum += BOID_VX(i);
+        acc[j].yvel_sum += BOID_VY(i);
+        acc[i].neighboring_boids++;
+        acc[j].neighboring_boids++;
+    }
+}
+
+// Compare boids i and j, the shortest way around the wrap-around arena
+static inline void neighbor_pair(struct boid_accum *acc, uint16_t i, uint16_t j)
+{
+    fix15 half_width = int2fix15(x_screen_right >> 1);
+    fix15 half_height = int2fix15(y_screen_bottom >> 1);
+    fix15 dx = BOID_X(i) - BOID_X(j);
+    fix15 dy = BOID_Y(i) - BOID_Y(j);
+
+    if (grid_wrap_x)
+    {
+        if (dx > half_width)
+        {
+            dx -= int2fix15(x_screen_right);
+        }
+        else if (dx < -half_width)
+        {
+            dx += int2fix15(x_screen_right);
+        }
+    }
+    if (grid_wrap_y)
+    {
+        if (dy > half_height)
+        {
+            dy -= int2fix15(y_screen_bottom);
+        }
+        else if (dy < -half_height)
+        {
+            dy += int2fix15(y_screen_bottom);
+        }
+    }
+
+    // Are both those differences less than the visual range?
+    if (absfix15(dx) < visualRange && absfix15(dy) < visualRange)
+    {
+        accumulate_pair(acc, i, j, dx, dy);
+    }
+}
+
+// Compare boid i against the boids in grid_index[first, last)
+static inline void grid_pairs(struct boid_accum *acc, uint16_t i, uint16_t first, uint16_t last)
+{
+    for (uint16_t b = first; b < last; b++)
+    {
+        neighbor_pair(acc, i, grid_index[b]);
+    }
+}
+
+// Forward neighbors of a cell: right, and the three below. Neighbors off
+// an edge wrap around, or are -1 where the arena does not wrap.
+static inline void grid_forward(int cx, int cy, int16_t neighbors[4])
+{
+    static const int8_t forward_x[4] = {1, -1, 0, 1};
+    static const int8_t forward_y[4] = {0, 1, 1, 1};
+
+    for (uint8_t k = 0; k < 4; k++)
+    {
+        int nx = cx + forward_x[k];
+        int ny = cy + forward_y[k];
+        neighbors[k] = -1;
+        if (nx < 0 || nx >= grid_cols)
+        {
+            if (!grid_wrap_x || grid_cols == 1)
+            {
+                continue;
+            }
+            nx = (nx + grid_cols) % grid_cols;
+        }
+        if (ny >= grid_rows)
+        {
+            if (!grid_wrap_y || grid_rows == 1)
+            {
+                continue;
+            }
+            ny -= grid_rows;
+        }
+        neighbors[k] = ny * grid_cols + nx;
+    }
+}
+
+// Neighbor search for the boids in grid_index[a_lo, a_hi), into the
+// neighbor sums acc of the calling core. Each pair of cells is visited
+// once, from the lower cell: the cell itself, then the neighbors to the
+// right and below.
+void boid_grid_calc(struct boid_accum *acc, uint16_t a_lo, uint16_t a_hi)
+{
+    uint16_t a = a_lo;
+    while (a < a_hi)
+    {
+        // The cell holding entry a, and where its entries (or the range) end
+        uint16_t cell = grid_cell_of(grid_index[a]);
+        uint16_t cell_end = grid_start[cell + 1];
+        uint16_t a_end = (cell_end < a_hi) ? cell_end : a_hi;
+
+        int16_t neighbors[4];
+        grid_forward(cell % grid_cols, cell / grid_cols, neighbors);
+
+        for (; a < a_end; a++)
+        {
+            uint16_t i = grid_index[a];
+
+            // The rest of this cell, then the forward neighbors
+            grid_pairs(acc, i, a + 1, cell_end);
+            for (uint8_t k = 0; k < 4; k++)
+            {
+                if (neighbors[k] >= 0)
+                {
+                    grid_pairs(acc, i, grid_start[neighbors[k]], grid_start[neighbors[k] + 1]);
+                }
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Sort key of boid i: its x in whole pixels, wrapped like grid_cell_of
+static inline int16_t sweep_key_of(uint16_t i)
+{
+    int x = fix2int15(BOID_X(i));
+    if (sweep_width)
+    {
+        if (x < 0) x += sweep_width;
+        else if (x >= sweep_width) x -= sweep_width;
+    }
+    return x;
+}
+
+// Bring the x order up to date with this frame's positions
+void sweep_sort()
+{
+    grid_wrap_x = (should_draw == 0);
+    grid_wrap_y = (should_draw != 1);
+    sweep_width = grid_wrap_x ? x_screen_right : 0;
+    sweep_range = (visualRange + (1 << 15) - 1) >> 15;
+
+    // Drop retired boids and append new ones, keeping the rest in order
+    if (sweep_n > curr_N_boids)
+    {
+        uint16_t kept = 0;
+        for (uint16_t a = 0; a < sweep_n; a++)
+        {
+            if (sweep_index[a] < curr_N_boids)
+            {
+                sweep_index[kept++] = sweep_index[a];
+            }
+        }
+        sweep_n = kept;
+    }
+    while (sweep_n < curr_N_boids)
+    {
+        sweep_index[sweep_n] = sweep_n;
+        sweep_n++;
+    }
+
+    // Insertion sort: nearly linear when the boids barely moved
+    for (uint16_t a = 0; a < sweep_n; a++)
+    {
+        sweep_key[a] = sweep_key_of(sweep_index[a]);
+    }
+    for (uint16_t a = 1; a < sweep_n; a++)
+    {
+        int16_t key = sweep_key[a];
+        uint16_t i = sweep_index[a];
+        uint16_t b = a;
+        while (b > 0 && sweep_key[b - 1] > key)
+        {
+            sweep_key[b] = sweep_key[b - 1];
+            sweep_index[b] = sweep_index[b - 1];
+            b--;
+        }
+        sweep_key[b] = key;
+        sweep_index[b] = i;
+    }
+}
+
+// Neighbor search for the boids in sweep_index[a_lo, a_hi), into the
+// neighbor sums acc of the calling core. Each pair is visited once, from
+// the boid further left.
+void boid_sweep_calc(struct boid_accum *acc, uint16_t a_lo, uint16_t a_hi)
+{
+    for (uint16_t a = a_lo; a < a_hi; a++)
+    {
+        uint16_t i = sweep_index[a];
+        int reach = sweep_key[a] + sweep_range;
+
+        // Boids ahead in x, up to visualRange
+        for (uint16_t b = a + 1; b < sweep_n && sweep_key[b] <= reach; b++)
+        {
+            neighbor_pair(acc, i, sweep_index[b]);
+        }
+
+        // Wrap-around arena: boids at the start of the order that are
+        // within visualRange past the right edge, unless they were
+        // already in range without wrapping
+        if (sweep_width)
+        {
+            reach -= sweep_width;
+            for (uint16_t b = 0; b < a && sweep_key[b] <= reach; b++)
+            {
+                if (sweep_key[a] - sweep_key[b] > sweep_range)
+                {
+                    neighbor_pair(acc, i, sweep_index[b]);
+                }
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Pair loop over boid rows [i_lo, i_hi), into the neighbor sums acc of the
+// calling core. Frames alternate between the pairs within each half of the
+// flock and the pairs across the halves, so each frame compares about half
+// of all pairs.
+void boid_pair_calc(struct boid_accum *acc, uint16_t i_lo, uint16_t i_hi, bool cross)
+{
+    for (uint16_t i = i_lo; i < i_hi; i++)
+    {
+        uint16_t j = i + 1;
+        uint16_t j_end = (i < half_N_boids) ? half_N_boids : curr_N_boids;
+        if (cross)
+        {
+            j = half_N_boids;
+            j_end = curr_N_boids;
+        }
+
+        for (; j < j_end; j++)
+        {
+            fix15 dx = BOID_X(i) - BOID_X(j);
+            fix15 dy = BOID_Y(i) - BOID_Y(j);
+            // Are both those differences less than the visual range?
+            if (absfix15(dx) < visualRange && absfix15(dy) < visualRange)
+            {
+                accumulate_pair(acc, i, j, dx, dy);
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Close a chunk at unit end once the running cost passes the next cut
+static uint32_t work_step;
+static uint32_t work_next_cut;
+
+static inline void work_cut(uint16_t end, uint32_t cost)
+{
+    if (cost >= work_next_cut && work_chunks < WORK_CHUNKS - 1)
+    {
+        work_start[++work_chunks] = end;
+        while (work_next_cut <= cost)
+        {
+            work_next_cut += work_step;
+        }
+    }
+}
+
+// Cut this frame's neighbor search into chunks of about equal cost and
+// reset the claim counter. Chunks are ranges of boid rows for the pair
+// loop, of grid_index for the grid, so a crowded cell can be shared, or
+// of sweep_index for the sweep. The cost of a boid is the pairs it
+// compares plus a little overhead. Runs on core 0 before the cores start
+// claiming.
+void work_plan()
+{
+    uint16_t units = (search_mode == SEARCH_PAIRS && work_cross) ? half_N_boids : curr_N_boids;
+    uint32_t cost = 0;
+
+    // Pass 0 totals the cost, pass 1 cuts it into WORK_CHUNKS even steps
+    for (uint8_t pass = 0; pass < 2; pass++)
+    {
+        work_step = cost / WORK_CHUNKS + 1;
+        work_next_cut = work_step;
+        work_chunks = 0;
+        cost = 0;
+
+        if (search_mode == SEARCH_GRID)
+        {
+            for (uint16_t cell = 0; cell < grid_cols * grid_rows; cell++)
+            {
+                uint16_t cell_end = grid_start[cell + 1];
+                if (grid_start[cell] == cell_end)
+                {
+                    continue;
+                }
+
+                // Boids in the forward neighbor cells
+                int16_t neighbors[4];
+                uint32_t forward = 0;
+                grid_forward(cell % grid_cols, cell / grid_cols, neighbors);
+                for (uint8_t k = 0; k < 4; k++)
+                {
+                    if (neighbors[k] >= 0)
+                    {
+                        forward += grid_start[neighbors[k] + 1] - grid_start[neighbors[k]];
+                    }
+                }
+
+                for (uint16_t a = grid_start[cell]; a < cell_end; a++)
+                {
+                    cost += (cell_end - a - 1) + forward + 4;
+                    if (pass)
+                    {
+                        work_cut(a + 1, cost);
+                    }
+                }
+            }
+        }
+        else if (search_mode == SEARCH_SWEEP)
+        {
+            // Window ends move right with a: the first entry out of reach,
+            // and the first out of reach past the wrapped edge
+            uint16_t end = 0;
+            uint16_t seam = 0;
+            for (uint16_t a = 0; a < units; a++)
+            {
+                int reach = sweep_key[a] + sweep_range;
+                while (end < units && sweep_key[end] <= reach)
+                {
+                    end++;
+                }
+                while (sweep_width && seam < a && sweep_key[seam] <= reach - sweep_width)
+                {
+                    seam++;
+                }
+                cost += (end - a - 1) + ((seam < a) ? seam : a) + 4;
+                if (pass)
+                {
+                    work_cut(a + 1, cost);
+                }
+            }
+        }
+        else
+        {
+            for (uint16_t i = 0; i < units; i++)
+            {
+                if (work_cross)
+                {
+                    cost += (curr_N_boids - half_N_boids) + 4;
+                }
+                else
+                {
+                    cost += ((i < half_N_boids) ? half_N_boids : curr_N_boids) - i + 3;
+                }
+                if (pass)
+                {
+                    work_cut(i + 1, cost);
+                }
+            }
+        }
+    }
+
+    // The last chunk ends at the last unit
+    work_start[0] = 0;
+    if (work_start[work_chunks] < units || work_chunks == 0)
+    {
+        work_start[++work_chunks] = units;
+    }
+
+    work_next = 0;
+}
+
+// Field cell of pixel coordinate x (or y), clamped to the field
+static inline int pfield_cell(int x, int cells)
+{
+    x >>= PFIELD_SHIFT;
+    return (x < 0) ? 0 : (x >= cells) ? cells - 1 : x;
+}
+
+// Stamp every predator into the field cells its predatory range overlaps.
+// Cells are clamped like boid lookups, so boids off the screen still see
+// the predators that can reach them.
+void pfield_build()
+{
+    memset(pfield, 0, sizeof(pfield));
+    for (uint8_t k = 0; k < curr_N_predators; k++)
+    {
+        int x_lo = pfield_cell(fix2int15(predators[k].x - predatory_range), PFIELD_COLS);
+        int x_hi = pfield_cell(fix2int15(predators[k].x + predatory_range), PFIELD_COLS);
+        int y_lo = pfield_cell(fix2int15(predators[k].y - predatory_range), PFIELD_ROWS);
+        int y_hi = pfield_cell(fix2int15(predators[k].y + predatory_range), PFIELD_ROWS);
+        for (int cy = y_lo; cy <= y_hi; cy++)
+        {
+            for (int cx = x_lo; cx <= x_hi; cx++)
+            {
+                pfield[cy][cx] |= 1u << k;
+            }
+        }
+    }
+}
+
+// Predators that may be within the predatory range of boid i, one bit each
+static inline uint32_t pfield_near(uint16_t i)
+{
+    if (!use_pfield)
+    {
+        return (curr_N_predators >= 32) ? ~0u : (1u << curr_N_predators) - 1;
+    }
+    return pfield[pfield_cell(fix2int15(BOID_Y(i)), PFIELD_ROWS)][pfield_cell(fix2int15(BOID_X(i)), PFIELD_COLS)];
+}
+
+// Signed distance from (px, py) to an obstacle, negative inside it, and
+// the unit direction away from it
+static float obstacle_distance(const struct obstacle *o, float px, float py, float *gx, float *gy)
+{
+    if (o->kind == OBSTACLE_DISC)
+    {
+        float dx = px - o->x0;
+        float dy = py - o->y0;
+        float len = sqrtf(dx * dx + dy * dy);
+        if (len < 1e-3f)
+        {
+            *gx = 1.0f;
+            *gy = 0.0f;
+            return -o->x1;
+        }
+        *gx = dx / len;
+        *gy = dy / len;
+        return len - o->x1;
+    }
+
+    // Rectangle: how far past each pair of edges (negative while between them)
+    float dx = fmaxf(o->x0 - px, px - o->x1);
+    float dy = fmaxf(o->y0 - py, py - o->y1);
+    float sx = (px < 0.5f * (o->x0 + o->x1)) ? -1.0f : 1.0f;
+    float sy = (py < 0.5f * (o->y0 + o->y1)) ? -1.0f : 1.0f;
+    float d;
+    if (dx > 0.0f || dy > 0.0f)
+    {
+        // Outside: to the nearest point of the rectangle
+        float ox = fmaxf(dx, 0.0f);
+        float oy = fmaxf(dy, 0.0f);
+        d = sqrtf(ox * ox + oy * oy);
+        *gx = sx * ox / d;
+        *gy = sy * oy / d;
+    }
+    else if (dx > dy)
+    {
+        // Inside: out through the nearest edge
+        d = dx;
+        *gx = sx;
+        *gy = 0.0f;
+    }
+    else
+    {
+        d = dy;
+        *gx = 0.0f;
+        *gy = sy;
+    }
+
+    // A room is the outside of its rectangle
+    if (o->kind == OBSTACLE_ROOM)
+    {
+        *gx = -*gx;
+        *gy = -*gy;
+        return -d;
+    }
+    return d;
+}
+
+// Add an obstacle, false if the list is full. Call ofield_bake() after.
+bool obstacle_add(uint8_t kind, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+{
+    if (n_obstacles >= OBSTACLES_MAX)
+    {
+        return false;
+    }
+    struct obstacle *o = &obstacles[n_obstacles++];
+    o->kind = kind;
+    o->x0 = (kind == OBSTACLE_DISC || x0 <= x1) ? x0 : x1;
+    o->x1 = (kind == OBSTACLE_DISC || x0 <= x1) ? x1 : x0;
+    o->y0 = (kind == OBSTACLE_DISC || y0 <= y1) ? y0 : y1;
+    o->y1 = (kind == OBSTACLE_DISC || y0 <= y1) ? y1 : y0;
+    return true;
+}
+
+// Rebuild the obstacle field from the arena walls and the obstacles. Runs
+// only when they change, so it can afford float math.
+void ofield_bake()
+{
+    // The arena's walls: the outside of the box, or the two sides past the lines
+    struct obstacle walls[2 + OBSTACLES_MAX];
+    uint8_t n_walls = 0;
+    if (should_draw == 1)
+    {
+        walls[n_walls++] = (struct obstacle){OBSTACLE_ROOM, x_margin_left_box, y_margin_top_box,
+                                             x_margin_right_box, y_margin_bottom_box};
+    }
+    else if (should_draw == 2)
+    {
+        walls[n_walls++] = (struct obstacle){OBSTACLE_RECT, -1000, -1000, x_margin_left_V_line, 1480};
+        walls[n_walls++] = (struct obstacle){OBSTACLE_RECT, x_margin_right_V_line, -1000, 1640, 1480};
+    }
+    for (uint8_t k = 0; k < n_obstacles; k++)
+    {
+        walls[n_walls++] = obstacles[k];
+    }
+
+    for (int row = 0; row < OFIELD_ROWS; row++)
+    {
+        for (int col = 0; col < OFIELD_COLS; col++)
+        {
+            float px = (float)((col << OFIELD_SHIFT) + OFIELD_HALF);
+            float py = (float)((row << OFIELD_SHIFT) + OFIELD_HALF);
+            float best = OFIELD_FAR;
+            float best_gx = 0.0f;
+            float best_gy = 0.0f;
+            for (uint8_t k = 0; k < n_walls; k++)
+            {
+                float gx, gy;
+                float d = obstacle_distance(&walls[k], px, py, &gx, &gy);
+                if (d < best)
+                {
+                    best = d;
+                    best_gx = gx;
+                    best_gy = gy;
+                }
+            }
+            struct ofield_cell *c = &ofield[row][col];
+            c->d = (int8_t)lroundf(fmaxf(best, -OFIELD_FAR));
+            c->gx = (int8_t)lroundf(best_gx * (1 << OFIELD_UNIT_SHIFT));
+            c->gy = (int8_t)lroundf(best_gy * (1 << OFIELD_UNIT_SHIFT));
+        }
+    }
+}
+
+// Turn by turnfactor away from any wall closer than ofield_range. The cell's
+// distance is carried from its center to (x, y) along the gradient, which is
+// exact for straight walls.
+static inline void ofield_steer(fix15 x, fix15 y, fix15 *vx, fix15 *vy)
+{
+    int px = fix2int15(x);
+    int py = fix2int15(y);
+    int col = px >> OFIELD_SHIFT;
+    int row = py >> OFIELD_SHIFT;
+    col = (col < 0) ? 0 : (col >= OFIELD_COLS) ? OFIELD_COLS - 1 : col;
+    row = (row < 0) ? 0 : (row >= OFIELD_ROWS) ? OFIELD_ROWS - 1 : row;
+    const struct ofield_cell *c = &ofield[row][col];
+
+    int d = c->d + ((c->gx * (px - (col << OFIELD_SHIFT) - OFIELD_HALF) +
+                     c->gy * (py - (row << OFIELD_SHIFT) - OFIELD_HALF)) >> OFIELD_UNIT_SHIFT);
+    if (d < ofield_range)
+    {
+        *vx = *vx + ((turnfactor * c->gx) >> OFIELD_UNIT_SHIFT);
+        *vy = *vy + ((turnfactor * c->gy) >> OFIELD_UNIT_SHIFT);
+    }
+}
+
+// Get the frame's neighbor search ready on core 0: sort the boids into
+// the grid or by x, or move the pair loop on to its other half of the
+// pairs. The predators have moved too, so stamp them into the field.
+void search_prepare()
+{
+    if (use_pfield)
+    {
+        pfield_build();
+    }
+
+    if (search_mode == SEARCH_GRID)
+    {
+        grid_build();
+    }
+    else if (search_mode == SEARCH_SWEEP)
+    {
+        sweep_sort();
+    }
+    else
+    {
+        // Toggle every other cycle flag
+        work_cross = !work_cross;
+    }
+}
+
+// Spinlock guarding the claim counter
+void work_init()
+{
+    work_lock = spin_lock_init(WORK_LOCK);
+}
+
+// Hand out the next chunk, or -1 when the frame's work is all claimed
+static inline int work_claim()
+{
+    spin_lock_unsafe_blocking(work_lock);
+    int k = work_next;
+    if (k < work_chunks)
+    {
+        work_next = k + 1;
+    }
+    spin_unlock_unsafe(work_lock);
+    return (k < work_chunks) ? k : -1;
+}
+
+// Claim and run chunks until none are left, timing this core's share
+void work_run(uint8_t core)
+{
+    uint32_t begin = time_us_32();
+    uint8_t claimed = 0;
+    int k;
+    while ((k = work_claim()) >= 0)
+    {
+        if (search_mode == SEARCH_GRID)
+        {
+            boid_grid_calc(scratch[core], work_start[k], work_start[k + 1]);
+        }
+        else if (search_mode == SEARCH_SWEEP)
+        {
+            boid_sweep_calc(scratch[core], work_start[k], work_start[k + 1]);
+        }
+        else
+        {
+            boid_pair_calc(scratch[core], work_start[k], work_start[k + 1], work_cross);
+        }
+        claimed++;
+    }
+    work_busy_us[core] = time_us_32() - begin;
+    work_claimed[core] = claimed;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Update the x and y positions of each boid
+void boid_algo_update(uint16_t i_update)
+{
+    // Sum the values from each core for boid update
+    struct boid_accum *acc_0 = &scratch[0][i_update];
+    struct boid_accum *acc_1 = &scratch[1][i_update];
+    fix15 close_dx = acc_0->close_dx + acc_1->close_dx;
+    fix15 close_dy = acc_0->close_dy + acc_1->close_dy;
+    fix15 xpos_sum = acc_0->xpos_sum + acc_1->xpos_sum;
+    fix15 ypos_sum = acc_0->ypos_sum + acc_1->ypos_sum;
+    fix15 xvel_sum = acc_0->xvel_sum + acc_1->xvel_sum;
+    fix15 yvel_sum = acc_0->yvel_sum + acc_1->yvel_sum;
+    uint16_t neighboring_boids = acc_0->neighboring_boids + acc_1->neighboring_boids;
+
+    // Unpack the boid's state
+    fix15 x = BOID_X(i_update);
+    fix15 y = BOID_Y(i_update);
+    fix15 vx = BOID_VX(i_update);
+    fix15 vy = BOID_VY(i_update);
+
+    // Initializes values only needed for each boid update
+    fix15 neighboring_boids_div;
+    fix15 fin_xpos_offset;
+    fix15 fin_ypos_offset;
+    fix15 fin_xvel_avg;
+    fix15 fin_yvel_avg;
+    fix15 speed;
+
+    // Sum the offsets from predators within the predatory range, checking
+    // only the predators the field has near this boid
+    fix15 predator_dx = 0;
+    fix15 predator_dy = 0;
+    uint8_t num_predators = 0;
+    uint32_t near = pfield_near(i_update);
+    while (near)
+    {
+        uint8_t k = __builtin_ctz(near);
+        near &= near - 1;
+        fix15 dx_p = x - predators[k].x;
+        fix15 dy_p = y - predators[k].y;
+
+        if (absfix15(dx_p) < predatory_range && absfix15(dy_p) < predatory_range)
+        {
+            predator_dx += dx_p;
+            predator_dy += dy_p;
+            num_predators++;
+        }
+    }
+
+    // If there were any boids in the visual range
+    if (neighboring_boids > 0)
+    {
+        // Divide accumulator variables by number of boids in visual range.
+        // The position sums are offsets, so their average is already the
+        // offset to the center of the neighbors.
+        if (neighboring_boids <= RECIP_MAX)
+        {
+            fin_xpos_offset = divcount(xpos_sum, neighboring_boids);
+            fin_ypos_offset = divcount(ypos_sum, neighboring_boids);
+            fin_xvel_avg = divcount(xvel_sum, neighboring_boids);
+            fin_yvel_avg = divcount(yvel_sum, neighboring_boids);
+        }
+        else
+        {
+            // Crowds past the table are rare, divide as before
+            neighboring_boids_div = int2fix15(neighboring_boids);
+            fin_xpos_offset = divfix(xpos_sum, neighboring_boids_div);
+            fin_ypos_offset = divfix(ypos_sum, neighboring_boids_div);
+            fin_xvel_avg = divfix(xvel_sum, neighboring_boids_div);
+            fin_yvel_avg = divfix(yvel_sum, neighboring_boids_div);
+        }
+
+        // Add the centering/matching contributions to velocity
+        vx = (vx +
+              multfix15(fin_xpos_offset, centeringfactor) +
+              multfix15(fin_xvel_avg - vx, matchingfactor));
+        vy = (vy +
+              multfix15(fin_ypos_offset, centeringfactor) +
+              multfix15(fin_yvel_avg - vy, matchingfactor));
+    }
+
+    // Add the avoidance contribution to velocity
+    vx = vx + multfix15(close_dx, avoidfactor);
+    vy = vy + multfix15(close_dy, avoidfactor);
+
+    // If the boid is near box, lines or an obstacle, make it turn by
+    // turnfactor. The field holds the walls of every arena.
+    if (use_ofield)
+    {
+        if (should_draw != 1) // wrap on top and bottom
+        {
+            if (y < int2fix15(y_screen_top))
+            {
+                y = int2fix15(y_screen_bottom);
+            }
+            if (y > int2fix15(y_screen_bottom))
+            {
+                y = int2fix15(y_screen_top);
+            }
+        }
+        if (should_draw == 0) // and on the sides
+        {
+            if (x < int2fix15(x_screen_left))
+            {
+                x = int2fix15(x_screen_right);
+            }
+            if (x > int2fix15(x_screen_right))
+            {
+                x = int2fix15(x_screen_left);
+            }
+        }
+        ofield_steer(x, y, &vx, &vy);
+    }
+    else if (should_draw == 0) // no box or lines, wrap everywhere
+    {
+        if (y < int2fix15(y_screen_top))
+        {
+            y = int2fix15(y_screen_bottom);
+        }
+        if (y > int2fix15(y_screen_bottom))
+        {
+            y = int2fix15(y_screen_top);
+        }
+        if (x < int2fix15(x_screen_left))
+        {
+            x = int2fix15(x_screen_right);
+        }
+        if (x > int2fix15(x_screen_right))
+        {
+            x = int2fix15(x_screen_left);
+        }
+    }
+    else if (should_draw == 1) // if should_draw == 1 --> box
+    {
+        if (y < int2fix15(y_margin_top_box))
+        {
+            vy = vy + turnfactor;
+        }
+        if (y > int2fix15(y_margin_bottom_box))
+        {
+            vy = vy - turnfactor;
+        }
+        if (x < int2fix15(x_margin_left_box))
+        {
+            vx = vx + turnfactor;
+        }
+        if (x > int2fix15(x_margin_right_box))
+        {
+            vx = vx - turnfactor;
+        }
+    }
+    else // should_draw == 2 --> draw 2 lines, wrap only on top and bottom
+    {
+        if (y < int2fix15(y_screen_top))
+        {
+            y = int2fix15(y_screen_bottom);
+        }
+        if (y > int2fix15(y_screen_bottom))
+        {
+            y = int2fix15(y_screen_top);
+        }
+        if (x < int2fix15(x_margin_left_V_line))
+        {
+            vx = vx + turnfactor;
+        }
+        if (x > int2fix15(x_margin_right_V_line))
+        {
+            vx = vx - turnfactor;
+        }
+    }
+
+    // If there were any predators in the predatory range, turn away
+    if (num_predators > 0)
+    {
+        if (predator_dy > 0)
+        {
+            vy = vy + predator_turnfactor;
+        }
+        if (predator_dy < 0)
+        {
+            vy = vy - predator_turnfactor;
+        }
+        if (predator_dx > 0)
+        {
+            vx = vx + predator_turnfactor;
+        }
+        if (predator_dx < 0)
+        {
+            vx = vx - predator_turnfactor;
+        }
+    }
+    //////////////////////////////////
+
+    // Calculate the boid's speed
+    // Calculated using the alpha beta max algorithm
+    // speed = 1*v_max + 1/4 * v_min --> shift by 2 instead of multiply 0.25
+    if (absfix15(vx) < absfix15(vy))
+    {
+
+        speed = absfix15(vy) + (absfix15(vx) >> 2);
+    }
+    else
+    {
+        speed = absfix15(vx) + (absfix15(vy) >> 2);
+    }
+
+    if (speed > maxspeed)
+    {
+        vx = vx - (vx >> 2);
+        vy = vy - (vy >> 2);
+    }
+    if (speed < minspeed)
+    {
+        vx = vx + (vx >> 2);
+        vy = vy + (vy >> 2);
+    }
+
+    // Update position using velocity, and pack the state back
+    x = x + vx;
+    y = y + vy;
+    boid_store(i_update, x, y, vx, vy);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void predator_algo(uint8_t l)
+{
+    fix15 speed;
+    // If the predator is near an edge, make it turn by turnfactor
+    // (this describes a box, will vary based on boundary conditions)
+    if (use_ofield)
+    {
+        if (should_draw != 1) // wrap on top and bottom
+        {
+            if (predators[l].y < int2fix15(y_screen_top))
+            {
+                predators[l].y = int2fix15(y_screen_bottom);
+            }
+            if (predators[l].y > int2fix15(y_screen_bottom))
+            {
+                predators[l].y = int2fix15(y_screen_top);
+            }
+        }
+        if (should_draw == 0) // and on the sides
+        {
+            if (predators[l].x < int2fix15(x_screen_left))
+            {
+                predators[l].x = int2fix15(x_screen_right);
+            }
+            if (predators[l].x > int2fix15(x_screen_right))
+            {
+                predators[l].x = int2fix15(x_screen_left);
+            }
+        }
+        ofield_steer(predators[l].x, predators[l].y, &predators[l].vx, &predators[l].vy);
+    }
+    else if (should_draw == 0) // wrap everywhere
+    {
+        if (predators[l].y < int2fix15(y_screen_top))
+        {
+            predators[l].y = int2fix15(y_screen_bottom);
+        }
+        if (predators[l].y > int2fix15(y_screen_bottom))
+        {
+            predators[l].y = int2fix15(y_screen_top);
+        }
+        if (predators[l].x < int2fix15(x_screen_left))
+        {
+            predators[l].x = int2fix15(x_screen_right);
+        }
+        if (predators[l].x > int2fix15(x_screen_right))
+        {
+            predators[l].x = int2fix15(x_screen_left);
+        }
+    }
+    else if (should_draw == 1) // if should_draw == 1 --> box
+    {
+        if (predators[l].y < int2fix15(y_margin_top_box))
+        {
+            predators[l].vy = predators[l].vy + turnfactor;
+        }
+        if (predators[l].y > int2fix15(y_margin_bottom_box))
+        {
+            predators[l].vy = predators[l].vy - turnfactor;
+        }
+        if (predators[l].x < int2fix15(x_margin_left_box))
+        {
+            predators[l].vx = predators[l].vx + turnfactor;
+        }
+        if (predators[l].x > int2fix15(x_margin_right_box))
+        {
+            predators[l].vx = predators[l].vx - turnfactor;
+        }
+    }
+    else // should_draw == 2 --> draw 2 lines, wrap only on top and bottom
+    {
+        if (predators[l].y < int2fix15(y_screen_top))
+        {
+            predators[l].y = int2fix15(y_screen_bottom);
+        }
+        if (predators[l].y > int2fix15(y_screen_bottom))
+        {
+            predators[l].y = int2fix15(y_screen_top);
+        }
+        if (predators[l].x < int2fix15(x_margin_left_V_line))
+        {
+            predators[l].vx = predators[l].vx + turnfactor;
+        }
+        if (predators[l].x > int2fix15(x_margin_right_V_line))
+        {
+            predators[l].vx = predators[l].vx - turnfactor;
+        }
+    }
+
+    // Calculate the predator's speed
+    if (absfix15(predators[l].vx) < absfix15(predators[l].vy))
+    {
+        speed = absfix15(predators[l].vy) + (absfix15(predators[l].vx) >> 2);
+    }
+    else
+    {
+        speed = absfix15(predators[l].vx) + (absfix15(predators[l].vy) >> 2);
+    }
+
+    if (speed > maxspeed)
+    {
+        predators[l].vx = predators[l].vx - (predators[l].vx >> 2);
+        predators[l].vy = predators[l].vy - (predators[l].vy >> 2);
+    }
+    if (speed < minspeed)
+    {
+        predators[l].vx = predators[l].vx + (predators[l].vx >> 2);
+        predators[l].vy = predators[l].vy + (predators[l].vy >> 2);
+    }
+
+    // Update position using velocity
+    predators[l].x = predators[l].x + predators[l].vx;
+    predators[l].y = predators[l].y + predators[l].vy;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// FNV-1a hash of the boid state, byte by byte in little-endian order so
+// the RP2040 and a host agree on it
+uint32_t boid_checksum()
+{
+    uint32_t hash = 2166136261u;
+    for (uint8_t f = 0; f < 4; f++)
+    {
+        for (uint16_t i = 0; i < curr_N_boids; i++)
+        {
+            fix15 field = (f == 0) ? BOID_X(i) : (f == 1) ? BOID_Y(i) : (f == 2) ? BOID_VX(i) : BOID_VY(i);
+            uint32_t v = (uint32_t)field;
+            for (uint8_t b = 0; b < 4; b++)
+            {
+                hash = (hash ^ ((v >> (8 * b)) & 0xff)) * 16777619u;
+            }
+        }
+    }
+    return hash;
+}
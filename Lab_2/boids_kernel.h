@@ -0,0 +1,209 @@
+/**
+ * Boids simulation kernel
+ *
+ * The flocking algorithm behind boids5.c without any display or hardware
+ * code: boid and predator state, the neighbor searches (all pairs, grid
+ * and sweep and prune), the work scheduler that shares the search between
+ * cores, and the velocity update. Built into boids5 for the RP2040, and on a host with
+ * -DBOIDS_HOST for boids_headless.c.
+ */
+
+#ifndef BOIDS_KERNEL_H
+#define BOIDS_KERNEL_H
+
+// Include standard libraries
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifdef BOIDS_HOST
+// Host build: plain 64-bit division in place of the RP2040 divider
+#define div_s64s64(a, b) ((a) / (b))
+#else
+#include "pico/divider.h"
+#endif
+
+// === the fixed point macros ========================================
+typedef signed int fix15;
+#define multfix15(a, b) ((fix15)((((signed long long)(a)) * ((signed long long)(b))) >> 15))
+#define float2fix15(a) ((fix15)((a)*32768.0)) // 2^15
+#define fix2float15(a) ((float)(a) / 32768.0)
+#define absfix15(a) abs(a)
+#define int2fix15(a) ((fix15)((a) << 15))
+#define fix2int15(a) ((int)((a) >> 15))
+#define char2fix15(a) (fix15)(((fix15)(a)) << 15)
+#define divfix(a, b) (fix15)(div_s64s64((((signed long long)(a)) << 15), ((signed long long)(b))))
+#define sqrtfix(a) (float2fix15(sqrt(fix2float15(a))))
+
+// Reciprocals of neighbor counts (Q31), so that averaging a sum over n
+// neighbors is a multiply instead of a 64-bit divide. Filled by recip_init().
+#define RECIP_SHIFT 31
+#define RECIP_MAX 256
+extern uint32_t recip_table[RECIP_MAX + 1];
+// fix15 sum a divided by an integer count 0 < n <= RECIP_MAX
+#define divcount(a, n) ((fix15)((((signed long long)(a)) * recip_table[n]) >> RECIP_SHIFT))
+
+// Neighbor sums for one boid, gathered during the neighbor search
+struct boid_accum
+{
+    fix15 close_dx;             // sum of offsets from boids in the protected range
+    fix15 close_dy;
+    fix15 xpos_sum;             // sum of offsets to boids in the visual range
+    fix15 ypos_sum;
+    fix15 xvel_sum;             // sum of velocities of boids in the visual range
+    fix15 yvel_sum;
+    uint16_t neighboring_boids; // number of boids in the visual range
+};
+
+// Predator struct
+struct predator
+{
+    // Current state of predators
+    fix15 x;
+    fix15 y;
+    fix15 vx;
+    fix15 vy;
+};
+
+// Boid state. Build with -DBOID_PACKED=1 to keep each boid in two words
+// instead of four: x and y with POS_FRAC fractional bits in one, vx and vy
+// as 8.8 in the other. The kernel reads and writes state only through
+// BOID_X() and friends and boid_store(), and computes in fix15 either way,
+// rounding on every store.
+#ifndef BOID_PACKED
+#define BOID_PACKED 0
+#endif
+
+// Boids and predators. The packed state leaves room for a few more boids
+// in the same RAM; the host runner may build with any number.
+#ifndef N_boids
+#if BOID_PACKED
+#define N_boids 1330   // Total # of possible boids
+#else
+#define N_boids 1209   // Total # of possible boids
+#endif
+#endif
+#define N_predators 32 // Total # of possible predators (one bit each in the predator field)
+extern uint16_t curr_N_boids;
+extern uint16_t half_N_boids;
+extern uint8_t curr_N_predators;
+extern struct predator predators[N_predators];
+extern struct boid_accum scratch[2][N_boids];
+
+#if BOID_PACKED
+#define POS_FRAC 4 // x and y span -2048 to 2047 pixels
+extern uint32_t boid_pos[N_boids]; // x in the low half, y in the high half
+extern uint32_t boid_vel[N_boids]; // vx in the low half, vy in the high half
+#define pack16(lo, hi) ((uint32_t)(uint16_t)(lo) | ((uint32_t)(uint16_t)(hi) << 16))
+#define unpack_lo(w) ((int16_t)(w))
+#define unpack_hi(w) ((int16_t)((w) >> 16))
+#define fix2pos(a) ((int16_t)(((a) + (1 << (14 - POS_FRAC))) >> (15 - POS_FRAC)))
+#define pos2fix(p) ((fix15)(p) * (1 << (15 - POS_FRAC)))
+#define fix2vel(a) ((int16_t)(((a) + (1 << 6)) >> 7))
+#define vel2fix(v) ((fix15)(v) * (1 << 7))
+#define BOID_X(i) pos2fix(unpack_lo(boid_pos[i]))
+#define BOID_Y(i) pos2fix(unpack_hi(boid_pos[i]))
+#define BOID_VX(i) vel2fix(unpack_lo(boid_vel[i]))
+#define BOID_VY(i) vel2fix(unpack_hi(boid_vel[i]))
+#define boid_store(i, x, y, vx, vy) (boid_pos[i] = pack16(fix2pos(x), fix2pos(y)), \
+                                     boid_vel[i] = pack16(fix2vel(vx), fix2vel(vy)))
+#define BOID_STATE_BYTES (2 * sizeof(uint32_t))
+#else
+extern fix15 boid_x[N_boids];
+extern fix15 boid_y[N_boids];
+extern fix15 boid_vx[N_boids];
+extern fix15 boid_vy[N_boids];
+#define BOID_X(i) (boid_x[i])
+#define BOID_Y(i) (boid_y[i])
+#define BOID_VX(i) (boid_vx[i])
+#define BOID_VY(i) (boid_vy[i])
+#define boid_store(i, x, y, vx, vy) (boid_x[i] = (x), boid_y[i] = (y), boid_vx[i] = (vx), boid_vy[i] = (vy))
+#define BOID_STATE_BYTES (4 * sizeof(fix15))
+#endif
+
+// RAM per boid: state plus both cores' neighbor sums
+#define BOID_BYTES (BOID_STATE_BYTES + 2 * sizeof(struct boid_accum))
+
+// Flocking parameters
+extern fix15 turnfactor;
+extern fix15 visualRange;
+extern fix15 protectedRange;
+extern fix15 centeringfactor;
+extern fix15 avoidfactor;
+extern fix15 matchingfactor;
+extern fix15 maxspeed;
+extern fix15 minspeed;
+extern fix15 predatory_range;
+extern fix15 predator_turnfactor;
+extern bool use_pfield;
+
+// Arena: 0 = wrap everywhere, 1 = box, 2 = two vertical lines
+extern uint8_t should_draw;
+extern uint16_t x_margin_left_box;
+extern uint16_t x_margin_right_box;
+extern uint16_t x_change_margin_box;
+extern uint16_t y_margin_top_box;
+extern uint16_t y_margin_bottom_box;
+extern uint16_t y_change_margin_box;
+extern uint16_t x_margin_left_V_line;
+extern uint16_t x_margin_right_V_line;
+extern uint16_t y_margin_top_line;
+extern uint16_t y_change_margin_line;
+extern uint16_t y_screen_top;
+extern uint16_t y_screen_bottom;
+extern uint16_t x_screen_left;
+extern uint16_t x_screen_right;
+
+// Obstacles: rectangles (corners x0,y0 and x1,y1) and discs (center x0,y0,
+// radius x1). A room is the outside of a rectangle, as the box arena is.
+// They are baked with the arena walls into the obstacle field, which the
+// boids and predators steer by when use_ofield is set; otherwise the arena
+// walls are checked one by one as before.
+#define OBSTACLE_RECT 0
+#define OBSTACLE_DISC 1
+#define OBSTACLE_ROOM 2
+#define OBSTACLES_MAX 16
+struct obstacle
+{
+    uint8_t kind;
+    int16_t x0;
+    int16_t y0;
+    int16_t x1;
+    int16_t y1;
+};
+extern struct obstacle obstacles[OBSTACLES_MAX];
+extern uint8_t n_obstacles;
+extern bool use_ofield;
+extern int16_t ofield_range;
+
+// Neighbor search: compare every pair (half of them each frame), look in
+// the grid cells around each boid, or sweep the boids sorted by x
+#define SEARCH_PAIRS 0
+#define SEARCH_GRID 1
+#define SEARCH_SWEEP 2
+extern uint8_t search_mode;
+extern bool work_cross;
+extern uint8_t work_chunks;
+extern volatile uint32_t work_busy_us[2];
+extern volatile uint8_t work_claimed[2];
+
+void recip_init();
+void work_init();
+void boid_seed(uint32_t seed);
+void spawn(fix15 *x, fix15 *y, fix15 *vx, fix15 *vy);
+void boid_spawn(uint16_t i);
+void flock_resize(uint16_t n);
+void grid_build();
+void sweep_sort();
+void pfield_build();
+bool obstacle_add(uint8_t kind, int16_t x0, int16_t y0, int16_t x1, int16_t y1);
+void ofield_bake();
+void search_prepare();
+void work_plan();
+void work_run(uint8_t core);
+void boid_algo_update(uint16_t i_update);
+void predator_algo(uint8_t l);
+uint32_t boid_checksum();
+
+#endif
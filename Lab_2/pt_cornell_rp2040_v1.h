@@ -651,6 +651,81 @@ do{ \
     multicore_fifo_drain() ; \
 } while(0)
 
+//====================================================================
+// Two-core barrier with sense reversal
+// Each core flips its own sense on arrival; the last core to arrive
+// resets the count and sets the shared sense to match, which opens the
+// barrier for both. A core that races ahead to the next wait is waiting
+// for the opposite sense, so one barrier can be reused back to back.
+//   struct pt_barrier b ;
+//   PT_BARRIER_INIT(&b, 27) ;     // once, before either core waits
+//   PT_BARRIER_WAIT(pt, &b) ;     // in a thread: yields while waiting
+//   pt_barrier_spin(&b) ;         // outside threads: sleeps in WFE
+// The core that opens the barrier sends an event (SEV) to wake a core
+// sleeping in WFE, so spinning does not poll SRAM. Each core's wait
+// time is kept in wait_us (last pass) and total_us (since init).
+// NOTE several barriers can share one spin lock (26-31 are free)
+struct pt_barrier {
+  volatile int count ;          // cores still to arrive
+  volatile int sense ;          // flips each time the barrier opens
+  int local_sense[2] ;          // sense each core is waiting for
+  unsigned int arrive_time[2] ; // when each core arrived (us)
+  unsigned int wait_us[2] ;     // time each core waited, last pass
+  unsigned int total_us[2] ;    // time each core waited, all passes
+  unsigned int passes ;         // times the barrier has opened
+  spin_lock_t *lock ;
+} ;
+
+#define PT_BARRIER_INIT(b,lock_num) do{ \
+  memset((void *)(b), 0, sizeof(struct pt_barrier)) ; \
+  (b)->count = 2 ; \
+  (b)->lock = spin_lock_init((uint)lock_num) ; \
+} while(0)
+
+// arrive at the barrier; returns 1 for the core that opens it
+static inline int pt_barrier_arrive(struct pt_barrier *b) {
+  int core = get_core_num() ;
+  int last ;
+  b->local_sense[core] = !b->local_sense[core] ;
+  b->arrive_time[core] = timer_hw->timerawl ;
+  spin_lock_unsafe_blocking(b->lock) ;
+  last = (--b->count == 0) ;
+  if (last) {
+    b->count = 2 ;
+    b->passes++ ;
+    b->sense = b->local_sense[core] ;
+  }
+  spin_unlock_unsafe(b->lock) ;
+  // wake the other core if it is sleeping in pt_barrier_spin
+  if (last) __sev() ;
+  return last ;
+}
+
+// true once the barrier this core arrived at has opened
+#define pt_barrier_open(b) ((b)->sense == (b)->local_sense[get_core_num()])
+
+// record how long this core waited
+static inline void pt_barrier_leave(struct pt_barrier *b) {
+  int core = get_core_num() ;
+  unsigned int waited = timer_hw->timerawl - b->arrive_time[core] ;
+  b->wait_us[core] = waited ;
+  b->total_us[core] += waited ;
+}
+
+// spinning flavor: for a core with nothing else to run
+static inline void pt_barrier_spin(struct pt_barrier *b) {
+  pt_barrier_arrive(b) ;
+  while (!pt_barrier_open(b)) __wfe() ;
+  pt_barrier_leave(b) ;
+}
+
+// yielding flavor: other threads on this core run while it waits
+#define PT_BARRIER_WAIT(pt,b) do{ \
+  pt_barrier_arrive(b) ; \
+  PT_YIELD_UNTIL(pt, pt_barrier_open(b)) ; \
+  pt_barrier_leave(b) ; \
+} while(0)
+
 //====================================================================
 // IMPROVED SCHEDULER 
 // === thread structures ===
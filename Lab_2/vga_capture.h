@@ -0,0 +1,159 @@
+/**
+ * Framebuffer capture over USB serial
+ *
+ * Streams the contents of vga_data_array to a host over the USB CDC
+ * port, one run-length encoded row at a time, from a protothread that
+ * only runs when the other threads on its core are yielding. Use
+ * vga_capture.py on the host to rebuild PNG frames.
+ *
+ * USAGE
+ *  - pico_enable_stdio_usb(<executable> 1) in CMakeLists.txt
+ *  - #include "vga_capture.h" after the protothreads and VGA headers
+ *  - call vgaCaptureInit() after stdio_init_all()
+ *  - pt_add_thread(protothread_capture) on the core that draws
+ *  - set vga_capture_frames to the number of frames wanted
+ *    (-1 to capture until it is set back to 0)
+ *
+ * STREAM FORMAT (little-endian)
+ *  - header:  "VGAC", version (1), bits per pixel (3 or 8),
+ *             width, height, bytes per row (16 bits each),
+ *             frame number, time in us (32 bits each)
+ *  - rows:    for each row, a 16-bit length and then that many bytes of
+ *             (count, value) pairs, 1 <= count <= 255
+ *  - trailer: "VEND", 32-bit sum of the raw framebuffer bytes
+ *
+ * NOTE
+ *  - Rows are read while the animation keeps drawing, so a frame can
+ *    tear if the scene changes during the capture.
+ *  - Text from printf stays on the UART; the USB port carries only frames.
+ *  - A VGA_CONSOLE_ONLY build has no framebuffer, so there is no capture
+ *    thread; vga_capture_frames is still there for the serial command.
+ */
+
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+
+// 3 for vga_graphics.c (two pixels per byte), 8 for vga256_graphics.c
+#ifndef VGA_CAPTURE_BPP
+#define VGA_CAPTURE_BPP 3
+#endif
+
+#if VGA_CAPTURE_BPP == 3
+#define VGA_CAPTURE_WIDTH     640
+#define VGA_CAPTURE_HEIGHT    480
+#define VGA_CAPTURE_ROW_BYTES 320
+#else
+#define VGA_CAPTURE_WIDTH     320
+#define VGA_CAPTURE_HEIGHT    240
+#define VGA_CAPTURE_ROW_BYTES 320
+#endif
+
+// Frames left to send (-1 = until stopped, 0 = idle)
+volatile int vga_capture_frames = 0 ;
+// Minimum time between captured frames (us)
+volatile unsigned int vga_capture_interval = 0 ;
+// Frames sent since boot
+volatile unsigned int vga_capture_count = 0 ;
+
+// Keep the USB port for frames only
+void vgaCaptureInit() {
+    stdio_set_driver_enabled(&stdio_usb, false) ;
+}
+
+#if VGA_CONSOLE != VGA_CONSOLE_ONLY
+
+extern unsigned char vga_data_array[] ;
+
+// Encoded row (worst case is two bytes per byte) plus its length
+static unsigned char vga_capture_row[2 + 2 * VGA_CAPTURE_ROW_BYTES] ;
+
+// Run-length encode n bytes into (count, value) pairs, returns encoded length
+static int vgaCaptureRLE(const unsigned char *src, int n, unsigned char *dst) {
+    int out = 0 ;
+    int i = 0 ;
+    while (i < n) {
+        unsigned char value = src[i] ;
+        int run = 1 ;
+        while ((i + run < n) && (src[i + run] == value) && (run < 255)) run++ ;
+        dst[out++] = run ;
+        dst[out++] = value ;
+        i += run ;
+    }
+    return out ;
+}
+
+static inline void vgaCapturePut16(unsigned char *dst, unsigned int v) {
+    dst[0] = v & 0xff ;
+    dst[1] = (v >> 8) & 0xff ;
+}
+
+static inline void vgaCapturePut32(unsigned char *dst, unsigned int v) {
+    vgaCapturePut16(dst, v & 0xffff) ;
+    vgaCapturePut16(dst + 2, v >> 16) ;
+}
+
+// Send len bytes, yielding whenever the USB transmit buffer is full.
+// Drops the bytes if the host disconnects (the host resyncs on "VGAC").
+#define PT_CAPTURE_SEND(buf, len) do { \
+    static int sent ; \
+    sent = 0 ; \
+    while (sent < (len)) { \
+        PT_YIELD_UNTIL(pt, !stdio_usb_connected() || (tud_cdc_write_available() > 0)) ; \
+        if (!stdio_usb_connected()) break ; \
+        int chunk = tud_cdc_write_available() ; \
+        if (chunk > ((len) - sent)) chunk = (len) - sent ; \
+        stdio_usb.out_chars((const char *)(buf) + sent, chunk) ; \
+        sent += chunk ; \
+    } \
+} while(0)
+
+// Low priority capture thread
+static PT_THREAD (protothread_capture(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    static unsigned char header[20] ;
+    static unsigned int checksum ;
+    static unsigned int last_time ;
+    static int row ;
+    static int len ;
+
+    while (1) {
+        // Wait for a request, and for the frame interval to pass
+        PT_YIELD_UNTIL(pt, (vga_capture_frames != 0) && stdio_usb_connected() &&
+                           ((time_us_32() - last_time) >= vga_capture_interval)) ;
+        last_time = time_us_32() ;
+
+        memcpy(header, "VGAC", 4) ;
+        header[4] = 1 ;
+        header[5] = VGA_CAPTURE_BPP ;
+        vgaCapturePut16(&header[6], VGA_CAPTURE_WIDTH) ;
+        vgaCapturePut16(&header[8], VGA_CAPTURE_HEIGHT) ;
+        vgaCapturePut16(&header[10], VGA_CAPTURE_ROW_BYTES) ;
+        vgaCapturePut32(&header[12], vga_capture_count) ;
+        vgaCapturePut32(&header[16], last_time) ;
+        PT_CAPTURE_SEND(header, 20) ;
+
+        checksum = 0 ;
+        for (row = 0; row < VGA_CAPTURE_HEIGHT; row++) {
+            const unsigned char *src = &vga_data_array[row * VGA_CAPTURE_ROW_BYTES] ;
+            for (int i = 0; i < VGA_CAPTURE_ROW_BYTES; i++) checksum += src[i] ;
+            len = vgaCaptureRLE(src, VGA_CAPTURE_ROW_BYTES, &vga_capture_row[2]) ;
+            vgaCapturePut16(vga_capture_row, len) ;
+            len += 2 ;
+            PT_CAPTURE_SEND(vga_capture_row, len) ;
+            // let the rest of the core run between rows
+            PT_YIELD(pt) ;
+        }
+
+        memcpy(header, "VEND", 4) ;
+        vgaCapturePut32(&header[4], checksum) ;
+        PT_CAPTURE_SEND(header, 8) ;
+        tud_cdc_write_flush() ;
+
+        vga_capture_count++ ;
+        if (vga_capture_frames > 0) vga_capture_frames-- ;
+    }
+    PT_END(pt) ;
+}
+
+#endif // VGA_CONSOLE != VGA_CONSOLE_ONLY
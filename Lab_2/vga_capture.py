@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Host side of vga_capture.h
+
+Reads the frame stream from the Pico's USB serial port (or from a file
+saved with e.g. `cat /dev/ttyACM0 > frames.bin`), rebuilds each frame,
+and writes it as a PNG. Works for both the 3-bit 640x480 library and the
+8-bit 320x240 library; the frame header says which one it is.
+
+    python3 vga_capture.py /dev/ttyACM0 -o frames
+    python3 vga_capture.py frames.bin -o frames
+
+Then on the Pico's UART console type `capture 10` (or `capture -1` and
+later `capture 0`). Needs pyserial only when reading from a serial port.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"VGAC"
+TRAILER = b"VEND"
+
+
+# 3-bit: bit 0 red, bit 1 green, bit 2 blue
+PALETTE3 = [((c & 1) * 255, ((c >> 1) & 1) * 255, ((c >> 2) & 1) * 255)
+            for c in range(8)]
+
+# 8-bit: rrrgggbb
+PALETTE8 = [(((c >> 5) & 7) * 255 // 7, ((c >> 2) & 7) * 255 // 7, (c & 3) * 255 // 3)
+            for c in range(256)]
+
+
+class Reader:
+    """Byte reader over a serial port or a file"""
+
+    def __init__(self, source):
+        if os.path.exists(source) and not source.startswith("/dev/"):
+            self.f = open(source, "rb")
+            self.serial = False
+        else:
+            import serial
+            self.f = serial.Serial(source, 115200, timeout=1)
+            self.serial = True
+
+    def read(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.f.read(n - len(data))
+            if not chunk:
+                if self.serial:
+                    continue
+                raise EOFError
+            data += chunk
+        return data
+
+    def sync(self):
+        """Skip bytes until the frame magic"""
+        window = b""
+        while window != MAGIC:
+            window = (window + self.read(1))[-4:]
+
+
+def unpack_row(encoded, row_bytes):
+    out = bytearray()
+    for i in range(0, len(encoded) - 1, 2):
+        out += bytes([encoded[i + 1]]) * encoded[i]
+    if len(out) != row_bytes:
+        raise ValueError("row decodes to %d bytes, expected %d" % (len(out), row_bytes))
+    return out
+
+
+def read_frame(reader):
+    reader.sync()
+    version, bpp, width, height, row_bytes, number, time_us = \
+        struct.unpack("<BBHHHII", reader.read(16))
+    if version != 1:
+        raise ValueError("unknown stream version %d" % version)
+    raw = bytearray()
+    for _ in range(height):
+        (length,) = struct.unpack("<H", reader.read(2))
+        raw += unpack_row(reader.read(length), row_bytes)
+    if reader.read(4) != TRAILER:
+        raise ValueError("missing trailer")
+    (checksum,) = struct.unpack("<I", reader.read(4))
+    if sum(raw) & 0xffffffff != checksum:
+        raise ValueError("checksum mismatch")
+    return bpp, width, height, number, time_us, raw
+
+
+def to_rgb(bpp, width, height, raw):
+    """Framebuffer bytes to PNG scanlines (filter byte + RGB)"""
+    lines = []
+    row_bytes = len(raw) // height
+    for y in range(height):
+        row = raw[y * row_bytes:(y + 1) * row_bytes]
+        line = bytearray(b"\x00")
+        if bpp == 3:
+            # two pixels per byte, even pixel in the low bits
+            for b in row:
+                line += bytes(PALETTE3[b & 7]) + bytes(PALETTE3[(b >> 3) & 7])
+        else:
+            for b in row[:width]:
+                line += bytes(PALETTE8[b])
+        lines.append(bytes(line))
+    return b"".join(lines)
+
+
+def write_png(path, width, height, scanlines):
+    def chunk(kind, data):
+        body = kind + data
+        return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body) & 0xffffffff)
+
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n")
+        f.write(chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0)))
+        f.write(chunk(b"IDAT", zlib.compress(scanlines, 6)))
+        f.write(chunk(b"IEND", b""))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("source", help="serial port or captured file")
+    parser.add_argument("-o", "--out", default="frames", help="output directory")
+    parser.add_argument("-n", "--frames", type=int, default=0, help="stop after this many frames")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    reader = Reader(args.source)
+
+    count = 0
+    first_host = first_dev = None
+    while True:
+        try:
+            bpp, width, height, number, time_us, raw = read_frame(reader)
+        except EOFError:
+            break
+        except ValueError as e:
+            # resync on the next header
+            print("dropped frame: %s" % e, file=sys.stderr)
+            continue
+
+        now = time.monotonic()
+        if first_host is None:
+            first_host, first_dev = now, time_us
+        path = os.path.join(args.out, "frame_%05d.png" % number)
+        write_png(path, width, height, to_rgb(bpp, width, height, raw))
+        count += 1
+
+        if count > 1:
+            dev_s = ((time_us - first_dev) & 0xffffffff) / 1e6
+            host_s = now - first_host
+            print("%s  %d-bit %dx%d  %.2f fps (device)  %.2f fps (host)" %
+                  (path, bpp, width, height, (count - 1) / dev_s,
+                   (count - 1) / host_s if host_s > 0 else 0.0))
+        else:
+            print("%s  %d-bit %dx%d" % (path, bpp, width, height))
+
+        if args.frames and count >= args.frames:
+            break
+
+
+if __name__ == "__main__":
+    main()
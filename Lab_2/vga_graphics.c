@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
 // Our assembled programs:
 // Each gets the name <pio_filename.pio.h>
 #include "hsync.pio.h"
@@ -25,8 +27,46 @@
 // Pixel color array that is DMA's to the PIO machines and
 // a pointer to the ADDRESS of this color array.
 // Note that this array is automatically initialized to all 0's (black)
-unsigned char vga_data_array[TXCOUNT];
+// (word aligned so that fills can write eight pixels at a time)
+#if VGA_CONSOLE != VGA_CONSOLE_ONLY
+unsigned char vga_data_array[TXCOUNT] __attribute__((aligned(4)));
+#endif
+
+#if VGA_CONSOLE == VGA_CONSOLE_OFF
 char * address_pointer = &vga_data_array[0] ;
+#else
+// Bytes per scanline (2 pixels per byte)
+#define LINE_BYTES 320
+
+// Character and attribute (color) for each console cell
+unsigned char console_chars[CONSOLE_ROWS * CONSOLE_COLS] ;
+unsigned char console_attrs[CONSOLE_ROWS * CONSOLE_COLS] ;
+
+// Font re-ordered by pixel row, so that one byte is one row of a cell
+static unsigned char console_font[256][8] ;
+
+// Two scanline buffers. DMA sends one while the other is being rendered,
+// and channel 1 restarts channel 0 from whichever address_pointer names.
+static unsigned int console_line[2][LINE_BYTES / 4] ;
+char * address_pointer = (char *)console_line[1] ;
+
+// Next scanline to render
+static int console_render_line = 0 ;
+
+static void consoleRenderLine(unsigned int *line, int y) ;
+static void consoleLineHandler(void) ;
+#endif
+
+// Frame service: the vsync machine raises PIO irq 2 once the last active
+// line is over, and this interrupt counts frames and timestamps vblank
+volatile unsigned int vga_frame_count = 0 ;
+volatile unsigned int vga_vblank_time = 0 ;
+
+static void __not_in_flash_func(vsyncHandler)(void) {
+    pio_interrupt_clear(pio0, 2) ;
+    vga_vblank_time = time_us_32() ;
+    vga_frame_count++ ;
+}
 
 // Bit masks for drawPixel routine
 #define TOPMASK 0b11000111
@@ -49,6 +89,14 @@ char textcolor, textbgcolor, wrap;
 #define _width 640
 #define _height 480
 
+// 4x4 Bayer threshold matrix for ordered dithering
+static const unsigned char bayer4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+} ;
+
 void initVGA() {
         // Choose which PIO instance to use (there are two instances, each with 4 state machines)
     PIO pio = pio0;
@@ -89,6 +137,17 @@ void initVGA() {
     int rgb_chan_0 = 0;
     int rgb_chan_1 = 1;
 
+#if VGA_CONSOLE != VGA_CONSOLE_OFF
+    // In console mode channel 0 sends one scanline at a time, and
+    // the channel 0 interrupt renders the line after next
+    consoleInit() ;
+    const void * first_read = console_line[0] ;
+    const uint first_count = LINE_BYTES ;
+#else
+    const void * first_read = vga_data_array ;
+    const uint first_count = TXCOUNT ;
+#endif
+
     // Channel Zero (sends color data to PIO VGA machine)
     dma_channel_config c0 = dma_channel_get_default_config(rgb_chan_0);  // default configs
     channel_config_set_transfer_data_size(&c0, DMA_SIZE_8);              // 8-bit txfers
@@ -101,8 +160,8 @@ void initVGA() {
         rgb_chan_0,                 // Channel to be configured
         &c0,                        // The configuration we just created
         &pio->txf[rgb_sm],          // write address (RGB PIO TX FIFO)
-        &vga_data_array,            // The initial read address (pixel color array)
-        TXCOUNT,                    // Number of transfers; in this case each is 1 byte.
+        first_read,                 // The initial read address (pixel color array)
+        first_count,                // Number of transfers; in this case each is 1 byte.
         false                       // Don't start immediately.
     );
 
@@ -122,14 +181,29 @@ void initVGA() {
         false                               // Don't start immediately.
     );
 
+#if VGA_CONSOLE != VGA_CONSOLE_OFF
+    // Render the next scanline whenever channel 0 finishes one
+    dma_channel_set_irq0_enabled(rgb_chan_0, true) ;
+    irq_set_exclusive_handler(DMA_IRQ_0, consoleLineHandler) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+#endif
+
+    // Count frames on the vsync machine's start-of-vblank irq
+    pio_set_irq0_source_enabled(pio, pis_interrupt2, true) ;
+    irq_set_exclusive_handler(PIO0_IRQ_0, vsyncHandler) ;
+    irq_set_enabled(PIO0_IRQ_0, true) ;
+
     /////////////////////////////////////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////////////////////////////////////
 
     // Initialize PIO state machine counters. This passes the information to the state machines
     // that they retrieve in the first 'pull' instructions, before the .wrap_target directive
     // in the assembly. Each uses these values to initialize some counting registers.
+    // The vsync program has no 'pull' of its own (all 32 instructions are in
+    // use), so it is run here instead.
     pio_sm_put_blocking(pio, hsync_sm, H_ACTIVE);
     pio_sm_put_blocking(pio, vsync_sm, V_ACTIVE);
+    pio_sm_exec(pio, vsync_sm, pio_encode_pull(false, false));
     pio_sm_put_blocking(pio, rgb_sm, RGB_ACTIVE);
 
 
@@ -147,11 +221,61 @@ void initVGA() {
 }
 
 
+// Frame service. Call vgaFrameDone() when a frame is drawn, wait for
+// vga_frame_count to reach frames->target, then call vgaFrameStart().
+// PT_YIELD_VBLANK in vga_graphics.h does all three.
+void vgaFrameDone(struct vga_frames *frames, unsigned int interval) {
+    /* Parameters:
+        frames:   frame statistics for one animation loop
+        interval: vblanks per animation frame (1 = 60 fps, 2 = 30 fps, ...)
+    */
+    unsigned int now = vga_frame_count ;
+    if (frames->frames == 0) {
+        // first frame, nothing to be late for
+        frames->target = now + 1 ;
+        return ;
+    }
+    frames->busy_us = time_us_32() - frames->start_us ;
+    frames->target += interval ;
+    if ((int)(now - frames->target) >= 0) {
+        // the target vblank already went by, so show this frame at the next one
+        frames->overruns += now - frames->target + 1 ;
+        frames->target = now + 1 ;
+    }
+}
+
+void vgaFrameStart(struct vga_frames *frames) {
+    unsigned int now = time_us_32() ;
+    if (frames->frames > 0) {
+        unsigned int bin = (now - frames->start_us) / VGA_FRAME_HIST_US ;
+        if (bin >= VGA_FRAME_HIST_BINS) bin = VGA_FRAME_HIST_BINS - 1 ;
+        frames->histogram[bin]++ ;
+    }
+    // measure the next interval from the vblank we actually woke on
+    frames->target = vga_frame_count ;
+    frames->start_us = now ;
+    frames->frames++ ;
+}
+
+void vgaFramePrint(struct vga_frames *frames) {
+    printf("frames=%u overruns=%u busy=%uus\n\r", frames->frames, frames->overruns, frames->busy_us) ;
+    for (int i = 0; i < VGA_FRAME_HIST_BINS; i++) {
+        if (frames->histogram[i] == 0) continue ;
+        printf("%s%2d-%2d ms: %u\n\r", (i == VGA_FRAME_HIST_BINS - 1) ? ">=" : "  ",
+               i * VGA_FRAME_HIST_US / 1000, (i + 1) * VGA_FRAME_HIST_US / 1000, frames->histogram[i]) ;
+    }
+}
+
+
 // A function for drawing a pixel with a specified color.
 // Note that because information is passed to the PIO state machines through
 // a DMA channel, we only need to modify the contents of the array and the
 // pixels will be automatically updated on the screen.
 void drawPixel(short x, short y, char color) {
+#if VGA_CONSOLE == VGA_CONSOLE_ONLY
+    // No framebuffer in console-only mode
+    return ;
+#else
     // Range checks (640x480 display)
     if (x > 639) x = 639 ;
     if (x < 0) x = 0 ;
@@ -170,6 +294,7 @@ void drawPixel(short x, short y, char color) {
     else {
         vga_data_array[pixel>>1] = (vga_data_array[pixel>>1] & BOTTOMMASK) | (color) ;
     }
+#endif
 }
 
 void drawVLine(short x, short y, short h, char color) {
@@ -336,6 +461,89 @@ void drawCircleHelper( short x0, short y0, short r, unsigned char cornername, ch
   }
 }
 
+// Filled circles up to this radius are drawn from cached span tables
+#define SPAN_TABLE_MAX 16
+
+// Half-width of each row of a filled circle, by radius and row offset
+// from the center. Built on first use from the same midpoint-circle steps
+// as fillCircleHelper, so both paths cover exactly the same pixels.
+static unsigned char span_table[SPAN_TABLE_MAX + 1][SPAN_TABLE_MAX + 1] ;
+static volatile unsigned int span_table_ready = 0 ;
+
+static const unsigned char * circleSpans(short r) {
+  if (!(span_table_ready & (1u << r))) {
+    unsigned char height[SPAN_TABLE_MAX + 1] = {0} ;
+    short f     = 1 - r;
+    short ddF_x = 1;
+    short ddF_y = -2 * r;
+    short x     = 0;
+    short y     = r;
+
+    // half-height of each column
+    height[0] = r ;
+    while (x<y) {
+      if (f >= 0) {
+        y--;
+        ddF_y += 2;
+        f     += ddF_y;
+      }
+      x++;
+      ddF_x += 2;
+      f     += ddF_x;
+      if (y > height[x]) height[x] = y ;
+      if (x > height[y]) height[y] = x ;
+    }
+    // half-width of each row is the widest column that reaches it
+    for (short dy = 0; dy <= r; dy++) {
+      unsigned char w = 0 ;
+      for (short c = 0; c <= r; c++) {
+        if (height[c] >= dy) w = c ;
+      }
+      span_table[r][dy] = w ;
+    }
+    span_table_ready |= (1u << r) ;
+  }
+  return span_table[r] ;
+}
+
+// Fill pixels x0 through x1 of row y, clipped to the screen. Pixels are
+// written two at a time (one byte), or eight at a time (one word) where
+// the span covers a whole aligned word.
+static void fillSpan(short x0, short x1, short y, char color) {
+#if VGA_CONSOLE == VGA_CONSOLE_ONLY
+    // No framebuffer in console-only mode
+    return ;
+#else
+  if ((y < 0) || (y > 479)) return ;
+  if (x0 < 0) x0 = 0 ;
+  if (x1 > 639) x1 = 639 ;
+  if (x0 > x1) return ;
+
+  unsigned char *row = &vga_data_array[320 * y] ;
+  color &= 0x7 ;
+  // an odd first pixel or even last pixel shares its byte with a neighbor
+  if (x0 & 1) {
+    row[x0>>1] = (row[x0>>1] & TOPMASK) | (color << 3) ;
+    x0++ ;
+  }
+  if (!(x1 & 1)) {
+    row[x1>>1] = (row[x1>>1] & BOTTOMMASK) | color ;
+    x1-- ;
+  }
+
+  int i = x0 >> 1 ;
+  int end = (x1 >> 1) + 1 ;
+  unsigned char pair = color | (color << 3) ;
+  unsigned int word = pair * 0x01010101u ;
+  while ((i < end) && (i & 3)) row[i++] = pair ;
+  while (i + 4 <= end) {
+    *(unsigned int *)&row[i] = word ;
+    i += 4 ;
+  }
+  while (i < end) row[i++] = pair ;
+#endif
+}
+
 void fillCircle(short x0, short y0, short r, char color) {
 /* Draw a filled circle with center (x0,y0) and radius r, with given color
  * Parameters:
@@ -347,8 +555,19 @@ void fillCircle(short x0, short y0, short r, char color) {
  *      color: 16-bit color value for the circle
  * Returns: Nothing
  */
-  drawVLine(x0, y0-r, 2*r+1, color);
-  fillCircleHelper(x0, y0, r, 3, 0, color);
+  if ((r < 0) || (r > SPAN_TABLE_MAX)) {
+    drawVLine(x0, y0-r, 2*r+1, color);
+    fillCircleHelper(x0, y0, r, 3, 0, color);
+    return ;
+  }
+
+  // small circles: one horizontal span per row
+  const unsigned char *span = circleSpans(r) ;
+  fillSpan(x0 - span[0], x0 + span[0], y0, color) ;
+  for (short dy = 1; dy <= r; dy++) {
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 - dy, color) ;
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 + dy, color) ;
+  }
 }
 
 void fillCircleHelper(short x0, short y0, short r, unsigned char cornername, short delta, char color) {
@@ -408,6 +627,21 @@ void drawRoundRect(short x, short y, short w, short h, short r, char color) {
 
 // Fill a rounded rectangle
 void fillRoundRect(short x, short y, short w, short h, short r, char color) {
+  if ((r >= 0) && (r <= SPAN_TABLE_MAX) && (w > 2*r) && (h > 2*r)) {
+    // small corners: one horizontal span per row
+    const unsigned char *span = circleSpans(r) ;
+    short top = y + r ;
+    short bottom = y + h - r - 1 ;
+    for (short j = top; j <= bottom; j++) {
+      fillSpan(x, x + w - 1, j, color) ;
+    }
+    for (short dy = 1; dy <= r; dy++) {
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], top - dy, color) ;
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], bottom + dy, color) ;
+    }
+    return ;
+  }
+
   // smarter version
   fillRect(x+r, y, w-2*r, h, color);
 
@@ -446,6 +680,86 @@ void fillRect(short x, short y, short w, short h, char color) {
   }
 }
 
+// ==================================================
+// === ordered (Bayer) dither engine
+// ==================================================
+// Build one 32-bit word (eight pixels) per row of the 4x4 Bayer
+// matrix. With one bit per channel the two nearest palette
+// entries are channel-off and channel-on, and the matrix decides
+// which one a pixel gets, so the area average lands on the
+// 24-bit color.
+void bayerPattern(unsigned int color24, unsigned int pattern[4]) {
+  int r = (color24 >> 16) & 0xff ;
+  int g = (color24 >> 8) & 0xff ;
+  int b = color24 & 0xff ;
+
+  for (int row=0; row<4; row++) {
+    pattern[row] = 0 ;
+    for (int col=0; col<8; col++) {
+      // threshold in the same 0-255 range as the channels
+      int t = (bayer4[row][col & 3] << 4) + 8 ;
+      unsigned int pixel = (r > t) | ((g > t) << 1) | ((b > t) << 2) ;
+      // two pixels per byte, even pixel in the low bits
+      pattern[row] |= pixel << ((col >> 1) * 8 + (col & 1) * 3) ;
+    }
+  }
+}
+
+// fill a rectangle with an ordered-dithered 24-bit color
+void fillRectBayer(short x, short y, short w, short h, unsigned int color24) {
+/* Draw a filled rectangle with starting top-left vertex (x,y),
+ *  width w and height h, approximating a 24-bit color with a
+ *  4x4 Bayer pattern of the two nearest palette entries
+ * Parameters:
+ *      x:  x-coordinate of top-left vertex; top left of screen is x=0
+ *              and x increases to the right
+ *      y:  y-coordinate of top-left vertex; top left of screen is y=0
+ *              and y increases to the bottom
+ *      w:  width of rectangle
+ *      h:  height of rectangle
+ *      color24:  0xRRGGBB color, see rgb24()
+ * Returns:     Nothing
+ */
+  unsigned int pattern[4] ;
+  bayerPattern(color24, pattern) ;
+  fillRectPattern(x, y, w, h, pattern) ;
+}
+
+// fill a rectangle with a pre-computed 4x4 pattern (see bayerPattern)
+void fillRectPattern(short x, short y, short w, short h, unsigned int pattern[4]) {
+  // clip to the screen
+  int x0 = (x < 0) ? 0 : x ;
+  int y0 = (y < 0) ? 0 : y ;
+  int x1 = ((x + w) > _width) ? _width : (x + w) ;
+  int y1 = ((y + h) > _height) ? _height : (y + h) ;
+  if ((x0 >= x1) || (y0 >= y1)) return ;
+
+  // whole words (eight pixels) between the first and last aligned pixel
+  int xa = (x0 + 7) & ~7 ;
+  int xb = x1 & ~7 ;
+  if (xa > xb) xa = xb = x1 ;
+
+  for (int j=y0; j<y1; j++) {
+    unsigned int word = pattern[j & 3] ;
+    int i ;
+    // leading pixels
+    for (i=x0; i<xa; i++) {
+      drawPixel(i, j, (word >> (((i & 7) >> 1) * 8 + (i & 1) * 3)) & 0x7) ;
+    }
+    // eight pixels per write
+#if VGA_CONSOLE != VGA_CONSOLE_ONLY
+    unsigned int *words = (unsigned int *)&vga_data_array[(640 * j + xa) >> 1] ;
+    for (i=xa; i<xb; i+=8) {
+      *words++ = word ;
+    }
+#endif
+    // trailing pixels
+    for (i=xb; i<x1; i++) {
+      drawPixel(i, j, (word >> (((i & 7) >> 1) * 8 + (i & 1) * 3)) & 0x7) ;
+    }
+  }
+}
+
 // Draw a character
 void drawChar(short x, short y, unsigned char c, char color, char bg, unsigned char size) {
     char i, j;
@@ -551,4 +865,103 @@ inline void writeString(char* str){
     while (*str){
         tft_write(*str++);
     }
-}
\ No newline at end of file
+}
+
+#if VGA_CONSOLE != VGA_CONSOLE_OFF
+// ==================================================
+// === text console (80x60 cells rendered at scanout)
+// ==================================================
+// Each cell is 8x8 pixels: the 5x7 glyph plus spacing. Cells hold a
+// character and an attribute byte (see consoleAttr), so rewriting
+// text is a store rather than a redraw, and no pixels are kept for it.
+
+void consoleInit() {
+  // transpose the column-major font into one byte per pixel row
+  for (int c=0; c<256; c++) {
+    for (int row=0; row<8; row++) {
+      unsigned char bits = 0 ;
+      for (int col=0; col<5; col++) {
+        if ((pgm_read_byte(font+(c*5)+col) >> row) & 1) bits |= (1 << col) ;
+      }
+      console_font[c][row] = bits ;
+    }
+  }
+  consoleClear() ;
+  // first two lines go out before the interrupt has run
+  console_render_line = 0 ;
+  consoleRenderLine(console_line[0], 0) ;
+  consoleRenderLine(console_line[1], 1) ;
+  console_render_line = 2 ;
+}
+
+void consoleClear() {
+  memset(console_chars, 0, sizeof(console_chars)) ;
+  memset(console_attrs, consoleAttr(WHITE, CONSOLE_CLEAR), sizeof(console_attrs)) ;
+}
+
+void consolePutChar(short col, short row, unsigned char c, char fg, char bg) {
+  if ((col < 0) || (col >= CONSOLE_COLS) || (row < 0) || (row >= CONSOLE_ROWS)) return ;
+  console_attrs[row * CONSOLE_COLS + col] = consoleAttr(fg, bg) ;
+  console_chars[row * CONSOLE_COLS + col] = c ;
+}
+
+void consoleWriteString(short col, short row, char* str, char fg, char bg) {
+/* Print text into the console, starting at cell (col,row). Text
+ * that runs past the end of the row is clipped.
+ */
+  while (*str && (col < CONSOLE_COLS)) {
+    consolePutChar(col++, row, *str++, fg, bg) ;
+  }
+}
+
+// Expand one scanline of console cells (over the framebuffer in overlay mode)
+static void __not_in_flash_func(consoleRenderLine)(unsigned int *line, int y) {
+  const unsigned char *chars = &console_chars[(y >> 3) * CONSOLE_COLS] ;
+  const unsigned char *attrs = &console_attrs[(y >> 3) * CONSOLE_COLS] ;
+  const int glyph_row = y & 7 ;
+
+#if VGA_CONSOLE == VGA_CONSOLE_OVERLAY
+  // start from the bitmap
+  const unsigned int *fb = (const unsigned int *)&vga_data_array[LINE_BYTES * y] ;
+  for (int i=0; i<(LINE_BYTES / 4); i++) {
+    line[i] = fb[i] ;
+  }
+#endif
+
+  for (int col=0; col<CONSOLE_COLS; col++) {
+    unsigned char c = chars[col] ;
+#if VGA_CONSOLE == VGA_CONSOLE_OVERLAY
+    // empty cells let the bitmap through
+    if (c == 0) continue ;
+#endif
+    unsigned char attr = attrs[col] ;
+    unsigned char bits = console_font[c][glyph_row] ;
+    unsigned char fg = attr & 0x7 ;
+    unsigned char bg = (attr >> 3) & 0x7 ;
+    // a byte is two pixels, so look colors up two glyph bits at a time
+    unsigned char pair[4] = { bg | (bg << 3), fg | (bg << 3), bg | (fg << 3), fg | (fg << 3) } ;
+    unsigned int word = pair[bits & 3] | (pair[(bits >> 2) & 3] << 8) |
+                        (pair[(bits >> 4) & 3] << 16) | (pair[(bits >> 6) & 3] << 24) ;
+#if VGA_CONSOLE == VGA_CONSOLE_OVERLAY
+    if (attr & CONSOLE_CLEAR_BIT) {
+      // only glyph pixels replace the bitmap
+      static const unsigned char mask_pair[4] = { 0x00, 0x07, 0x38, 0x3f } ;
+      unsigned int mask = mask_pair[bits & 3] | (mask_pair[(bits >> 2) & 3] << 8) |
+                          (mask_pair[(bits >> 4) & 3] << 16) | (mask_pair[(bits >> 6) & 3] << 24) ;
+      word = (line[col] & ~mask) | (word & mask) ;
+    }
+#endif
+    line[col] = word ;
+  }
+}
+
+// Channel 0 has just finished a scanline and channel 1 has restarted it on
+// the other buffer, so this one is free for the line after next
+static void __not_in_flash_func(consoleLineHandler)() {
+  dma_hw->ints0 = 1u << 0 ;
+  unsigned int *line = console_line[console_render_line & 1] ;
+  consoleRenderLine(line, console_render_line) ;
+  address_pointer = (char *)line ;
+  if (++console_render_line == 480) console_render_line = 0 ;
+}
+#endif
@@ -12,6 +12,7 @@
  *
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
+ *  - PIO0_IRQ_0 (vsync irq 2, frame counter)
  *  - DMA channels 0, 1, 2, and 3
  *  - 153.6 kBytes of RAM (for pixel color data)
  *
@@ -28,6 +29,56 @@ enum vga_pins {HSYNC=16, VSYNC, RED_PIN, GREEN_PIN, BLUE_PIN} ;
 // We can only produce 8 (3-bit) colors, so let's give them readable names - usable in main()
 enum colors {BLACK, RED, GREEN, YELLOW, BLUE, MAGENTA, CYAN, WHITE} ;
 
+// Text console: 80x60 character cells (8x8 pixels) that are expanded into
+// scanline buffers during scanout. Choose a mode at compile time, e.g.
+// target_compile_definitions(boids PRIVATE VGA_CONSOLE=1) in CMakeLists.txt
+//  - VGA_CONSOLE_OFF     bitmap framebuffer only
+//  - VGA_CONSOLE_OVERLAY console cells drawn over the bitmap framebuffer
+//  - VGA_CONSOLE_ONLY    console alone, ~10 kBytes instead of the framebuffer
+// Console modes also use DMA_IRQ_0 (channel 0) to render each scanline.
+#define VGA_CONSOLE_OFF     0
+#define VGA_CONSOLE_OVERLAY 1
+#define VGA_CONSOLE_ONLY    2
+#ifndef VGA_CONSOLE
+#define VGA_CONSOLE VGA_CONSOLE_OFF
+#endif
+
+#define CONSOLE_COLS 80
+#define CONSOLE_ROWS 60
+// Background "color" that lets the framebuffer show through (overlay mode)
+#define CONSOLE_CLEAR 8
+#define CONSOLE_CLEAR_BIT 0x40
+// Cell attribute byte: foreground, background, and clear-background flag
+#define consoleAttr(fg, bg) (((fg) & 0x7) | (((bg) & 0x7) << 3) | (((bg) & CONSOLE_CLEAR) ? CONSOLE_CLEAR_BIT : 0))
+
+// Frame service: vga_frame_count advances at the start of every vblank (60 Hz).
+// Each animation loop keeps its own vga_frames, and ends a frame with
+//     PT_YIELD_VBLANK(pt, &frames, 2) ;   // 30 fps, locked to the display
+// which yields until the next due vblank and counts the vblanks it missed.
+#define VGA_FRAME_HIST_BINS 32      // frame-to-frame time histogram bins
+#define VGA_FRAME_HIST_US   2000    // width of each bin (us)
+
+struct vga_frames {
+    unsigned int target ;       // vblank count the next frame waits for
+    unsigned int start_us ;     // time the current frame started
+    unsigned int busy_us ;      // time the last frame spent before waiting
+    unsigned int frames ;       // frames started
+    unsigned int overruns ;     // vblanks missed because a frame ran long
+    unsigned int histogram[VGA_FRAME_HIST_BINS] ;
+} ;
+
+extern volatile unsigned int vga_frame_count ;
+extern volatile unsigned int vga_vblank_time ;
+
+#define PT_YIELD_VBLANK(pt, frames, interval) do { \
+    vgaFrameDone((frames), (interval)) ; \
+    PT_YIELD_UNTIL((pt), (int)(vga_frame_count - (frames)->target) >= 0) ; \
+    vgaFrameStart(frames) ; \
+} while(0)
+
+// 24-bit (8 bits per channel) colors for the dither engine
+#define rgb24(r,g,b) ((((r) & 0xff)<<16) | (((g) & 0xff)<<8) | ((b) & 0xff))
+
 // VGA primitives - usable in main
 void initVGA(void) ;
 void drawPixel(short x, short y, char color) ;
@@ -42,6 +93,9 @@ void fillCircleHelper(short x0, short y0, short r, unsigned char cornername, sho
 void drawRoundRect(short x, short y, short w, short h, short r, char color) ;
 void fillRoundRect(short x, short y, short w, short h, short r, char color) ;
 void fillRect(short x, short y, short w, short h, char color) ;
+void bayerPattern(unsigned int color24, unsigned int pattern[4]) ;
+void fillRectPattern(short x, short y, short w, short h, unsigned int pattern[4]) ;
+void fillRectBayer(short x, short y, short w, short h, unsigned int color24) ;
 void drawChar(short x, short y, unsigned char c, char color, char bg, unsigned char size) ;
 void setCursor(short x, short y);
 void setTextColor(char c);
@@ -49,4 +103,15 @@ void setTextColor2(char c, char bg);
 void setTextSize(unsigned char s);
 void setTextWrap(char w);
 void tft_write(unsigned char c) ;
-void writeString(char* str) ;
\ No newline at end of file
+void writeString(char* str) ;
+
+// Frame service - usable in main
+void vgaFrameDone(struct vga_frames *frames, unsigned int interval) ;
+void vgaFrameStart(struct vga_frames *frames) ;
+void vgaFramePrint(struct vga_frames *frames) ;
+
+// Text console - usable in main when VGA_CONSOLE is not VGA_CONSOLE_OFF
+void consoleInit(void) ;
+void consoleClear(void) ;
+void consolePutChar(short col, short row, unsigned char c, char fg, char bg) ;
+void consoleWriteString(short col, short row, char* str, char fg, char bg) ;
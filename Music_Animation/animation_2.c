@@ -187,12 +187,38 @@ struct predator
 
 // Initializing boids
 #define N_flocks 3
+#ifndef N_boids
 #define N_boids 200                 // Max number of boids per flock
+#endif
 uint16_t curr_N_boids = 10;        // Current number of boids
 struct boid rock_flock[N_boids];    // Avoids paper flock
 struct boid paper_flock[N_boids];   // Avoids scissor flock
 struct boid scissor_flock[N_boids]; // Avoids rock flock
 
+// Each flock, and the flock it avoids (the next one along)
+struct boid *flocks[N_flocks] = {rock_flock, paper_flock, scissor_flock};
+#define predator_flock_of(flock_type) (((flock_type) + 1) % N_flocks)
+
+// Spatial index over all three flocks. Every boid goes in one uniform
+// grid, tagged with its flock, so one pass over the cells around a boid
+// finds both its flockmates and the boids of the flock it avoids. Cells
+// are at least visualRange and predator_flock_range wide, so all of those
+// are in the boid's own cell or the 8 around it. Rebuilt every frame by a
+// counting sort.
+#define INDEX_MAX_COLS 32
+#define INDEX_MAX_ROWS 24
+#define INDEX_TYPE_SHIFT 14
+#define index_entry(flock_type, i) ((uint16_t)(((flock_type) << INDEX_TYPE_SHIFT) | (i)))
+#define index_type(e) ((e) >> INDEX_TYPE_SHIFT)
+#define index_boid(e) ((e) & ((1 << INDEX_TYPE_SHIFT) - 1))
+bool use_index = true;                                    // false = scan every flock for every boid
+uint16_t index_start[INDEX_MAX_COLS * INDEX_MAX_ROWS + 1]; // first entry of each cell
+uint16_t index_entries[N_flocks * N_boids];               // tagged boids sorted by cell
+uint8_t index_cols = 1;
+uint8_t index_rows = 1;
+uint16_t index_cell_w = 640;
+uint16_t index_cell_h = 480;
+
 // Initializing boid parameters
 fix15 turnfactor = float2fix15(0.2);
 fix15 visualRange = int2fix15(40);
@@ -456,7 +482,170 @@ void spawn(fix15 *x, fix15 *y, fix15 *vx, fix15 *vy)
     *vy = int2fix15(rand() % 3 + 3);
 }
 
-// Boid_algo initial calculation for ith boid
+// Index cell of a boid. Boids off the screen go in the nearest edge cell.
+static inline uint16_t index_cell_of(struct boid *b)
+{
+    int cx = fix2int15(b->x) / index_cell_w;
+    int cy = fix2int15(b->y) / index_cell_h;
+    if (cx < 0) cx = 0;
+    if (cx >= index_cols) cx = index_cols - 1;
+    if (cy < 0) cy = 0;
+    if (cy >= index_rows) cy = index_rows - 1;
+    return cy * index_cols + cx;
+}
+
+// Sort every boid of every flock into the index, with cells sized from
+// the current visualRange
+void index_build()
+{
+    int range = fix2int15(visualRange);
+    if (fix2int15(predator_flock_range) > range)
+    {
+        range = fix2int15(predator_flock_range);
+    }
+    if (range < 1)
+    {
+        range = 1;
+    }
+
+    // Round the cell count down so cells are never narrower than the range
+    int cols = 640 / range;
+    int rows = 480 / range;
+    if (cols > INDEX_MAX_COLS) cols = INDEX_MAX_COLS;
+    if (rows > INDEX_MAX_ROWS) rows = INDEX_MAX_ROWS;
+    if (cols < 1) cols = 1;
+    if (rows < 1) rows = 1;
+    index_cols = cols;
+    index_rows = rows;
+    index_cell_w = 640 / cols;
+    index_cell_h = 480 / rows;
+
+    // Counting sort: count each cell, turn counts into cell ends, then
+    // place boids back to front so each cell ends up at its start
+    uint16_t n_cells = cols * rows;
+    memset(index_start, 0, (n_cells + 1) * sizeof(index_start[0]));
+    for (uint8_t flock_type = 0; flock_type < N_flocks; flock_type++)
+    {
+        for (uint16_t i = 0; i < curr_N_boids; i++)
+        {
+            index_start[index_cell_of(&flocks[flock_type][i])]++;
+        }
+    }
+    for (uint16_t c = 1; c < n_cells; c++)
+    {
+        index_start[c] += index_start[c - 1];
+    }
+    for (int flock_type = N_flocks - 1; flock_type >= 0; flock_type--)
+    {
+        for (int i = curr_N_boids - 1; i >= 0; i--)
+        {
+            index_entries[--index_start[index_cell_of(&flocks[flock_type][i])]] = index_entry(flock_type, i);
+        }
+    }
+    index_start[n_cells] = N_flocks * curr_N_boids;
+}
+
+// One pair of tagged boids. Flockmates add to each other's flocking sums;
+// otherwise one of the two is from the flock the other avoids, and only
+// the avoiding boid steers away.
+static inline void index_pair(uint16_t e_a, uint16_t e_b)
+{
+    uint8_t type_a = index_type(e_a);
+    uint8_t type_b = index_type(e_b);
+    struct boid *a = &flocks[type_a][index_boid(e_a)];
+    struct boid *b = &flocks[type_b][index_boid(e_b)];
+    fix15 dx = a->x - b->x;
+    fix15 dy = a->y - b->y;
+
+    if (type_a == type_b)
+    {
+        // Are both those differences less than the visual range?
+        if (absfix15(dx) < visualRange && absfix15(dy) < visualRange)
+        {
+            // Are both those differences less than the protected range?
+            if (absfix15(dx) < protectedRange && absfix15(dy) < protectedRange)
+            {
+                a->close_dx += dx;
+                a->close_dy += dy;
+                b->close_dx -= dx;
+                b->close_dy -= dy;
+            }
+            else // Boid is in the visual range
+            {
+                a->xpos_avg += b->x;
+                a->ypos_avg += b->y;
+                a->xvel_avg += b->vx;
+                a->yvel_avg += b->vy;
+                b->xpos_avg += a->x;
+                b->ypos_avg += a->y;
+                b->xvel_avg += a->vx;
+                b->yvel_avg += a->vy;
+                a->neighboring_boids++;
+                b->neighboring_boids++;
+            }
+        }
+    }
+    // Are both those differences less than the flock predatory range?
+    else if (absfix15(dx) < predator_flock_range && absfix15(dy) < predator_flock_range)
+    {
+        if (type_b == predator_flock_of(type_a))
+        {
+            a->predator_flock_dx += dx;
+            a->predator_flock_dy += dy;
+            a->num_flock_predators++;
+        }
+        else
+        {
+            b->predator_flock_dx -= dx;
+            b->predator_flock_dy -= dy;
+            b->num_flock_predators++;
+        }
+    }
+}
+
+// Visit every pair of boids in neighboring cells once, from the lower
+// cell: the rest of the cell itself, then the cells to the right and below
+void index_calc()
+{
+    static const int8_t forward_x[4] = {1, -1, 0, 1};
+    static const int8_t forward_y[4] = {0, 1, 1, 1};
+
+    for (uint16_t cell = 0; cell < index_cols * index_rows; cell++)
+    {
+        int cx = cell % index_cols;
+        int cy = cell / index_cols;
+        uint16_t cell_end = index_start[cell + 1];
+
+        for (uint16_t a = index_start[cell]; a < cell_end; a++)
+        {
+            for (uint16_t b = a + 1; b < cell_end; b++)
+            {
+                index_pair(index_entries[a], index_entries[b]);
+            }
+            for (uint8_t k = 0; k < 4; k++)
+            {
+                int nx = cx + forward_x[k];
+                int ny = cy + forward_y[k];
+                if (nx < 0 || nx >= index_cols || ny >= index_rows)
+                {
+                    continue;
+                }
+                uint16_t neighbor = ny * index_cols + nx;
+                for (uint16_t b = index_start[neighbor]; b < index_start[neighbor + 1]; b++)
+                {
+                    index_pair(index_entries[a], index_entries[b]);
+                }
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Boid_algo initial calculation for ith boid. With the spatial index on,
+// index_calc() has already gathered the flock sums, and only the
+// predators are left.
 void boid_algo_init_calc(uint16_t curr_boid, uint8_t flock_type)
 {
     struct boid *curr_flock;
@@ -478,7 +667,7 @@ void boid_algo_init_calc(uint16_t curr_boid, uint8_t flock_type)
         predator_flock = rock_flock;
     }
 
-    for (uint16_t i = curr_boid + 1; i < curr_N_boids; i++)
+    for (uint16_t i = curr_boid + 1; i < curr_N_boids && !use_index; i++)
     {
         fix15 dx_i = curr_flock[curr_boid].x - curr_flock[i].x;
         fix15 dy_i = curr_flock[curr_boid].y - curr_flock[i].y;
@@ -518,14 +707,14 @@ void boid_algo_init_calc(uint16_t curr_boid, uint8_t flock_type)
         }
     }
 
-    for (uint8_t i = 0; i < curr_N_boids; i++)
+    for (uint16_t i = 0; i < curr_N_boids && !use_index; i++)
     {
         // Compute the differences in x and y coordinates
         fix15 dx_flock_p = curr_flock[curr_boid].x - predator_flock[i].x;
         fix15 dy_flock_p = curr_flock[curr_boid].y - predator_flock[i].y;
 
         // Are both those differences less than the flock predatory range?
-        if (absfix15(dx_flock_p) < predator_flock_range && absfix15(dx_flock_p) < predator_flock_range)
+        if (absfix15(dx_flock_p) < predator_flock_range && absfix15(dy_flock_p) < predator_flock_range)
         {
             curr_flock[curr_boid].predator_flock_dx += curr_flock[curr_boid].x - predator_flock[i].x;
             curr_flock[curr_boid].predator_flock_dy += curr_flock[curr_boid].y - predator_flock[i].y;
@@ -810,6 +999,7 @@ static PT_THREAD(protothread_serial(struct pt *pt))
             printf("numberBoids <int> 0\n\r");
             printf("mood <int>\n\r");
             printf("splash\n\r");
+            printf("index on/off\n\r");
             printf("from\n\n");
         }
         else if (strcmp(cmd, "from") == 0)
@@ -877,6 +1067,10 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 }
 
                 curr_N_boids = (uint16_t)(atoi(arg1));
+                if (curr_N_boids > N_boids)
+                {
+                    curr_N_boids = N_boids;
+                }
 
                 // Spawn boid flocks
                 for (uint16_t current_boid = 0; current_boid < curr_N_boids; current_boid++)
@@ -932,6 +1126,18 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 }
             }
         }
+        else if (strcmp(cmd, "index") == 0)
+        {
+            // one spatial index for all flocks, or scan every flock for every boid
+            if (strcmp(arg1, "on") == 0)
+            {
+                use_index = true;
+            }
+            else if (strcmp(arg1, "off") == 0)
+            {
+                use_index = false;
+            }
+        }
         else if (strcmp(cmd, "mood") == 0)
         {
             if (arg1 != NULL)
@@ -1077,6 +1283,13 @@ static PT_THREAD(protothread_anim(struct pt *pt))
         // ////////////////////////////////////////////////////////////////////////
         // ////////////////////////////////////////////////////////////////////////
 
+        // Flocking and flock avoidance for all three flocks in one pass
+        if (use_index)
+        {
+            index_build();
+            index_calc();
+        }
+
         for (uint8_t flock_type = 0; flock_type < N_flocks; flock_type++)
         {
             for (uint16_t current_boid = 0; current_boid < curr_N_boids; current_boid++)
@@ -25,7 +25,8 @@
 // Pixel color array that is DMA's to the PIO machines and
 // a pointer to the ADDRESS of this color array.
 // Note that this array is automatically initialized to all 0's (black)
-unsigned char vga_data_array[TXCOUNT];
+// (word aligned so that fills can write eight pixels at a time)
+unsigned char vga_data_array[TXCOUNT] __attribute__((aligned(4)));
 char * address_pointer = &vga_data_array[0] ;
 
 // Bit masks for drawPixel routine
@@ -336,6 +337,84 @@ void drawCircleHelper( short x0, short y0, short r, unsigned char cornername, ch
   }
 }
 
+// Filled circles up to this radius are drawn from cached span tables
+#define SPAN_TABLE_MAX 16
+
+// Half-width of each row of a filled circle, by radius and row offset
+// from the center. Built on first use from the same midpoint-circle steps
+// as fillCircleHelper, so both paths cover exactly the same pixels.
+static unsigned char span_table[SPAN_TABLE_MAX + 1][SPAN_TABLE_MAX + 1] ;
+static volatile unsigned int span_table_ready = 0 ;
+
+static const unsigned char * circleSpans(short r) {
+  if (!(span_table_ready & (1u << r))) {
+    unsigned char height[SPAN_TABLE_MAX + 1] = {0} ;
+    short f     = 1 - r;
+    short ddF_x = 1;
+    short ddF_y = -2 * r;
+    short x     = 0;
+    short y     = r;
+
+    // half-height of each column
+    height[0] = r ;
+    while (x<y) {
+      if (f >= 0) {
+        y--;
+        ddF_y += 2;
+        f     += ddF_y;
+      }
+      x++;
+      ddF_x += 2;
+      f     += ddF_x;
+      if (y > height[x]) height[x] = y ;
+      if (x > height[y]) height[y] = x ;
+    }
+    // half-width of each row is the widest column that reaches it
+    for (short dy = 0; dy <= r; dy++) {
+      unsigned char w = 0 ;
+      for (short c = 0; c <= r; c++) {
+        if (height[c] >= dy) w = c ;
+      }
+      span_table[r][dy] = w ;
+    }
+    span_table_ready |= (1u << r) ;
+  }
+  return span_table[r] ;
+}
+
+// Fill pixels x0 through x1 of row y, clipped to the screen. Pixels are
+// written two at a time (one byte), or eight at a time (one word) where
+// the span covers a whole aligned word.
+static void fillSpan(short x0, short x1, short y, char color) {
+  if ((y < 0) || (y > 479)) return ;
+  if (x0 < 0) x0 = 0 ;
+  if (x1 > 639) x1 = 639 ;
+  if (x0 > x1) return ;
+
+  unsigned char *row = &vga_data_array[320 * y] ;
+  color &= 0x7 ;
+  // an odd first pixel or even last pixel shares its byte with a neighbor
+  if (x0 & 1) {
+    row[x0>>1] = (row[x0>>1] & TOPMASK) | (color << 3) ;
+    x0++ ;
+  }
+  if (!(x1 & 1)) {
+    row[x1>>1] = (row[x1>>1] & BOTTOMMASK) | color ;
+    x1-- ;
+  }
+
+  int i = x0 >> 1 ;
+  int end = (x1 >> 1) + 1 ;
+  unsigned char pair = color | (color << 3) ;
+  unsigned int word = pair * 0x01010101u ;
+  while ((i < end) && (i & 3)) row[i++] = pair ;
+  while (i + 4 <= end) {
+    *(unsigned int *)&row[i] = word ;
+    i += 4 ;
+  }
+  while (i < end) row[i++] = pair ;
+}
+
 void fillCircle(short x0, short y0, short r, char color) {
 /* Draw a filled circle with center (x0,y0) and radius r, with given color
  * Parameters:
@@ -347,8 +426,19 @@ void fillCircle(short x0, short y0, short r, char color) {
  *      color: 16-bit color value for the circle
  * Returns: Nothing
  */
-  drawVLine(x0, y0-r, 2*r+1, color);
-  fillCircleHelper(x0, y0, r, 3, 0, color);
+  if ((r < 0) || (r > SPAN_TABLE_MAX)) {
+    drawVLine(x0, y0-r, 2*r+1, color);
+    fillCircleHelper(x0, y0, r, 3, 0, color);
+    return ;
+  }
+
+  // small circles: one horizontal span per row
+  const unsigned char *span = circleSpans(r) ;
+  fillSpan(x0 - span[0], x0 + span[0], y0, color) ;
+  for (short dy = 1; dy <= r; dy++) {
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 - dy, color) ;
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 + dy, color) ;
+  }
 }
 
 void fillCircleHelper(short x0, short y0, short r, unsigned char cornername, short delta, char color) {
@@ -408,6 +498,21 @@ void drawRoundRect(short x, short y, short w, short h, short r, char color) {
 
 // Fill a rounded rectangle
 void fillRoundRect(short x, short y, short w, short h, short r, char color) {
+  if ((r >= 0) && (r <= SPAN_TABLE_MAX) && (w > 2*r) && (h > 2*r)) {
+    // small corners: one horizontal span per row
+    const unsigned char *span = circleSpans(r) ;
+    short top = y + r ;
+    short bottom = y + h - r - 1 ;
+    for (short j = top; j <= bottom; j++) {
+      fillSpan(x, x + w - 1, j, color) ;
+    }
+    for (short dy = 1; dy <= r; dy++) {
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], top - dy, color) ;
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], bottom + dy, color) ;
+    }
+    return ;
+  }
+
   // smarter version
   fillRect(x+r, y, w-2*r, h, color);
 
@@ -17,7 +17,8 @@
  *
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
- *  - DMA channels 0, 1
+ *  - DMA channels 0, 1, 4, and 5
+ *  - DMA_IRQ_1 (ADC capture blocks)
  *
  *
  */
@@ -49,6 +50,8 @@
 
 // protothreads header
 #include "pt_cornell_rp2040_v1_1_1.h"
+// Framebuffer capture over USB serial
+#include "vga_capture.h"
 
 // The fixed point macros
 typedef signed int fix15;
@@ -83,12 +86,24 @@ typedef signed int fix15;
 #define Fs 10000.0
 // ADC clock rate (unmutable!)
 #define ADCCLK 48000000.0
+// Mid-scale of the 8-bit samples. It is taken off before the FFT so that
+// the DC bias doesn't set the FFT's block exponent (only bin 0 changes).
+#define ADC_MIDSCALE 128
 
-fix15 max_fr ;           // temporary variable for max freq calculation
+fix15 max_fr ;           // magnitude of the loudest note
 
-// DMA channels for sampling ADC (VGA driver uses 0 and 1)
-int sample_chan = 4;
-int control_chan = 5;
+// Capture ring for the ADC: twice the FFT length, filled block by block
+// with no gaps between blocks (a power of two, so indices wrap with a mask)
+#define CAPTURE_SAMPLES (2 * NUM_SAMPLES)
+// Samples per DMA block (25.6 ms at 10 kHz)
+#define CAPTURE_BLOCK (NUM_SAMPLES / 4)
+// Default samples between the starts of successive FFT windows (50% overlap)
+#define HOP_SAMPLES (NUM_SAMPLES / 2)
+
+// DMA channels for sampling ADC (VGA driver uses 0 and 1). They take turns
+// filling the blocks of the capture ring, each chained to the other.
+int sample_chan_a = 4;
+int sample_chan_b = 5;
 
 // Max and min macros
 #define max(a, b) ((a > b) ? a : b)
@@ -97,8 +112,15 @@ int control_chan = 5;
 // 0.4 in fixed point (used for alpha max plus beta min)
 fix15 zero_point_4 = float2fix15(0.4);
 
-// Here's where we'll have the DMA channel put ADC samples
-uint8_t sample_array[NUM_SAMPLES];
+// Here's where we'll have the DMA channels put ADC samples
+uint8_t sample_array[CAPTURE_SAMPLES];
+// Samples captured since the start, counted by the DMA interrupt
+volatile unsigned int capture_count = 0;
+// Windows skipped because the FFT fell more than a hop behind
+unsigned int capture_skipped = 0;
+// Samples between FFT windows: NUM_SAMPLES / 2 for 50% overlap,
+// NUM_SAMPLES / 4 for 75% (set with the "hop" command)
+unsigned int hop_samples = HOP_SAMPLES;
 // And here's where we'll copy those samples for FFT calculation
 fix15 fr[NUM_SAMPLES];
 fix15 fi[NUM_SAMPLES];
@@ -108,9 +130,6 @@ fix15 Sinewave[NUM_SAMPLES];
 // Hann window table for FFT calculation
 fix15 window[NUM_SAMPLES];
 
-// Pointer to address of start of sample buffer
-uint8_t *sample_address_pointer = &sample_array[0];
-
 // Structure arrays
 struct note_mag_freq_array // Struct that keeps mag and frequency of notes
 {
@@ -133,12 +152,24 @@ int counter_overall_mood = 0;
 fix15 percent_diff = 0;
 fix15 percent_diff_threshold = float2fix15(0.01);
 fix15 old_note_mag = float2fix15(0.001);
-fix15 freq_calc = float2fix15(Fs / NUM_SAMPLES);
 fix15 percentage_high_note_diff = float2fix15(0.05);
 fix15 mag_threshold = float2fix15(1.5);
 volatile bool turn_on_predator = false;
 int size_circle = 2;
 
+// Notes below this frequency (Hz) are ignored, which keeps DC and mains hum
+// out of the peak picking
+#define PEAK_MIN_FREQ 40.0
+
+// Length of the FFT for note detection, as log2 of the number of samples
+// (set with the "fftsize" command). LOG2_NUM_SAMPLES for 1024 points
+// (102 ms windows), or 8 for 256 points (26 ms, and a quarter of the work).
+// With the peak interpolation both find a note's pitch to within a few
+// cents. At 256 points (39 Hz bins) notes below about 130 Hz can be up to
+// 20 cents off, and notes too close together below a few hundred Hz blur
+// into one (Audio/g_Audio_FFT/fft_host_test.c measures this).
+int fft_log2_n = LOG2_NUM_SAMPLES;
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -152,6 +183,11 @@ int size_circle = 2;
 
 // uS per frame
 #define FRAME_RATE 120000
+// Vblanks per frame (2 = 30 fps, locked to the 60 Hz display)
+#define FRAME_VBLANKS 2
+
+// Frame timing for the animation loop (see vga256_graphics.h)
+struct vga_frames anim_frames;
 
 // Boid and predator structs
 struct boid
@@ -254,28 +290,52 @@ volatile bool turn_on_predator_core1 = false;
 
 
 
+// The background is a grid of tiles, each drawn in the average hue of the
+// boids inside it. Tiles are a power of two on a side so a boid's tile is two
+// shifts away, and the hue sums are kept running: a boid only touches them
+// when it crosses into another tile or its hue changes, and only tiles whose
+// color actually changed are redrawn.
 struct tile
 {
-    // Current state of predators
     int x;
     int y;
-    int total_hue;
-    int num_boids;
+    int total_hue;          // sum of the hues of the boids in the tile
+    int num_boids;          // boids in the tile
+    unsigned int color;     // color last drawn (24-bit)
+    bool dirty;             // sums or mood changed since the tile was last drawn
 };
 
-#define MAX_TILES 192
-// #define SCREEN_WIDTH 320
-// #define SCREEN_HEIGHT 240
-int width = 16;  // tiles wide
-int height = 12; // tiles wide
-int total_tiles = 192;
-int tile_side = 20;
+#define TILE_SHIFT 4                            // 16 px tiles
+#define TILE_SIDE (1 << TILE_SHIFT)
+#define TILES_WIDE (320 >> TILE_SHIFT)          // 20
+#define TILES_HIGH (240 >> TILE_SHIFT)          // 15
+#define MAX_TILES (TILES_WIDE * TILES_HIGH)     // 300
+#define TILE_NONE 0xffff                        // boid not counted in any tile
+#define TILE_COLOR_NONE 0xffffffff              // tile not drawn yet
 
 struct tile tiles[MAX_TILES];
 
+// Tile each boid is counted in, and the hue it was counted with
+uint16_t boid_tile[N_boids];
+int boid_tile_hue[N_boids];
+uint16_t tiles_N_boids = 0;     // boids counted in the tiles
+
+// Tiles whose sums changed this frame, then the tiles whose color changed
+uint16_t tiles_dirty[MAX_TILES];
+uint16_t tiles_N_dirty = 0;
+uint16_t tiles_changed[MAX_TILES];
+uint16_t tiles_N_changed = 0;
+
+// Mood the empty tiles were last drawn in
+int tiles_mood = -1;
+// Set when something drew over the tiles, to repaint all of them
+volatile bool tiles_redraw = true;
+
+// Time spent on the tiles, apart from the simulation (see "frames")
+unsigned int sim_us = 0;
+unsigned int tile_sum_us = 0;
+unsigned int tile_draw_us = 0;
 
-// Debugging
-float error = 0;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -444,30 +504,101 @@ int music_stuff()
     return num_new_colors;
 }
 
-// Peforms an in-place FFT. For more information about how this
-// algorithm works, please see https://vanhunteradams.com/FFT/FFT.html
-void FFTfix(fix15 fr[], fix15 fi[])
+// Find the k loudest local maxima of the magnitudes mag[first..last] (a bin
+// louder than the one below it and at least as loud as the one above) and
+// put them in peaks[], loudest first. The frequency of each comes from a
+// parabola through the log magnitudes of its bin and the two neighbours
+// (Gaussian interpolation), which lands well within a tenth of a bin of the
+// true frequency, rather than the nearest bin of a 2^log2_n point FFT.
+// Entries with no peak are zeroed. Returns the number of peaks found.
+int find_peaks(fix15 mag[], int first, int last, int log2_n,
+               struct note_mag_freq_array peaks[], int k)
 {
+    int found = 0;
+    int i, j;
+    float la, lb, lc; // log magnitudes around a peak
+    float den;        // curvature of the parabola
+    float delta;      // offset of its top from the bin (bins)
 
-    unsigned short m;  // one of the indices being swapped
-    unsigned short mr; // the other index being swapped (r for reversed)
-    fix15 tr, ti;      // for temporary storage while swapping, and during iteration
+    for (j = 0; j < k; j++)
+    {
+        peaks[j].mag = 0;
+        peaks[j].freq = 0;
+    }
+    // Insert each local maximum louder than the quietest kept one, keeping
+    // its bin in freq for now
+    for (i = first; i <= last; i++)
+    {
+        if (mag[i] <= mag[i - 1] || mag[i] < mag[i + 1] || mag[i] <= peaks[k - 1].mag)
+            continue;
+        for (j = k - 1; j > 0 && peaks[j - 1].mag < mag[i]; j--)
+        {
+            peaks[j] = peaks[j - 1];
+        }
+        peaks[j].mag = mag[i];
+        peaks[j].freq = i;
+        if (found < k)
+            found++;
+    }
+    // Interpolate, and turn bins into Hz
+    for (j = 0; j < found; j++)
+    {
+        i = peaks[j].freq;
+        la = logf((float)max(mag[i - 1], 1));
+        lb = logf((float)mag[i]);
+        lc = logf((float)max(mag[i + 1], 1));
+        den = la - 2 * lb + lc;
+        delta = (den < 0) ? 0.5f * (la - lc) / den : 0;
+        peaks[j].freq = float2fix15((i + delta) * (Fs / (1 << log2_n)));
+    }
+    return found;
+}
 
-    int i, j; // indices being combined in Danielson-Lanczos part of the algorithm
-    int L;    // length of the FFT's being combined
-    int k;    // used for looking up trig values from sine table
+// Bit reversal swap list for FFTfix: the pairs of indices to exchange for
+// one FFT length, two entries per pair, built the first time that length runs
+unsigned short fft_swaps[NUM_SAMPLES];
+int fft_n_swaps = 0;      // entries in fft_swaps
+int fft_swaps_log2_n = 0; // log2 of the length the list was built for
 
-    int istep; // length of the FFT which results from combining two FFT's
+// Twiddles of the radix-4 stages. A stage combining FFT's of length L needs
+// W^m, W^2m and W^3m (W = exp(-2pi i/4L), real and imaginary parts) for
+// m = 1..L-1. They are stored at entries L..2L-2, in the order the stage
+// reads them, so each stage walks its own stretch of the table.
+fix15 fft_twiddle[NUM_SAMPLES >> 1][6];
 
-    fix15 wr, wi; // trigonometric values from lookup table
-    fix15 qr, qi; // temporary variables used during DL part of the algorithm
+// Block floating point: FFTfix halves the data only when a stage could
+// overflow, instead of at every stage, so quiet input keeps its precision
+bool fft_block_float = true;
 
-    //////////////////////////////////////////////////////////////////////////
-    ////////////////////////// BIT REVERSAL //////////////////////////////////
-    //////////////////////////////////////////////////////////////////////////
+// Fill the twiddle table for FFTfix. Call once before the first FFT.
+void FFTinit()
+{
+    int L, m, p;
+    double a;
+    for (L = 2; L <= (NUM_SAMPLES >> 2); L <<= 1)
+    {
+        for (m = 1; m < L; m++)
+        {
+            for (p = 1; p <= 3; p++)
+            {
+                a = 6.283185307179586 * p * m / (4 * L);
+                fft_twiddle[L - 1 + m][2 * p - 2] = float2fix15(cos(a));
+                fft_twiddle[L - 1 + m][2 * p - 1] = -float2fix15(sin(a));
+            }
+        }
+    }
+}
+
+// List the index pairs the bit reversal swaps for a 2^log2_n point FFT
+void FFTswaps(int log2_n)
+{
+    unsigned short m;  // one of the indices being swapped
+    unsigned short mr; // the other index being swapped (r for reversed)
+
+    fft_n_swaps = 0;
     // Bit reversal code below based on that found here:
     // https://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
-    for (m = 1; m < NUM_SAMPLES_M_1; m++)
+    for (m = 1; m < (1 << log2_n) - 1; m++)
     {
         // swap odd and even bits
         mr = ((m >> 1) & 0x5555) | ((m & 0x5555) << 1);
@@ -478,63 +609,263 @@ void FFTfix(fix15 fr[], fix15 fi[])
         // swap bytes
         mr = ((mr >> 8) & 0x00FF) | ((mr & 0x00FF) << 8);
         // shift down mr
-        mr >>= SHIFT_AMOUNT;
+        mr >>= SHIFT_AMOUNT + LOG2_NUM_SAMPLES - log2_n;
         // don't swap that which has already been swapped
         if (mr <= m)
             continue;
+        fft_swaps[fft_n_swaps++] = m;
+        fft_swaps[fft_n_swaps++] = mr;
+    }
+    fft_swaps_log2_n = log2_n;
+}
+
+// Magnitude for the block peak: x, or -x - 1 when negative, which has the
+// same top bit except at -2^k (one bit lower, and FFTshift allows for it)
+#define FFTpeak(x) ((x) ^ ((x) >> 31))
+
+// Last step of a radix-4 butterfly. The quarters at i, i+L, i+2L and i+3L
+// hold the FFT's of the samples 0, 2, 1 and 3 mod 4, here already
+// multiplied by their twiddles (a, b, c, d). Combine them into the four
+// outputs, divided by 2^shift (4 in fixed scaling, like two radix-2
+// stages). In block floating point returns the OR of the outputs'
+// magnitudes (see FFTpeak), for the next stage.
+static inline fix15 FFTradix4(fix15 fr[], fix15 fi[], int i, int L, int shift, bool block,
+                              fix15 ar, fix15 ai, fix15 br, fix15 bi,
+                              fix15 cr, fix15 ci, fix15 dr, fix15 di)
+{
+    fix15 sr = ar + br, si = ai + bi; // even samples, first half
+    fix15 tr = ar - br, ti = ai - bi; // even samples, second half
+    fix15 ur = cr + dr, ui = ci + di; // odd samples, first half
+    fix15 vr = cr - dr, vi = ci - di; // odd samples, second half
+    fix15 peak;
+    // (the inputs' names are reused for the outputs)
+    ar = (sr + ur) >> shift;
+    ai = (si + ui) >> shift;
+    cr = (sr - ur) >> shift;
+    ci = (si - ui) >> shift;
+    // the second half of the odd samples turns by -i, then by +i
+    br = (tr + vi) >> shift;
+    bi = (ti - vr) >> shift;
+    dr = (tr - vi) >> shift;
+    di = (ti + vr) >> shift;
+    fr[i] = ar;
+    fi[i] = ai;
+    fr[i + L] = br;
+    fi[i + L] = bi;
+    fr[i + 2 * L] = cr;
+    fi[i + 2 * L] = ci;
+    fr[i + 3 * L] = dr;
+    fi[i + 3 * L] = di;
+    if (!block)
+        return 0;
+    peak = FFTpeak(ar) | FFTpeak(ai) | FFTpeak(br) | FFTpeak(bi);
+    return peak | FFTpeak(cr) | FFTpeak(ci) | FFTpeak(dr) | FFTpeak(di);
+}
+
+// Halvings a block floating point stage needs so that its output stays
+// below 2^28, given the OR of its input magnitudes and the highest input
+// bit that cannot overflow (24 for a radix-4 stage, which can grow the peak
+// by 4 sqrt(2), and 26 for a radix-2 stage, which can double it). A peak
+// with top bit b is below 2^(b+1), or equal to it from FFTpeak, which the
+// half-bit margin of the 4 sqrt(2) bound and the 2^31 limit both cover.
+static inline int FFTshift(fix15 peak, int top)
+{
+    int bit = peak ? 31 - __builtin_clz(peak) : 0;
+    return bit > top ? bit - top : 0;
+}
+
+// Peforms an in-place FFT of 2^log2_n points (at most NUM_SAMPLES). For more
+// information about how this algorithm works, please see
+// https://vanhunteradams.com/FFT/FFT.html
+// The bit reversal runs from a precomputed swap list, and the stages are
+// radix 4 (after one radix-2 stage for odd powers of two) with twiddles
+// from fft_twiddle. Input must stay below 2^28 in magnitude (8-bit samples
+// are below 2^23). Returns the block exponent: the number of halvings, so
+// that the result is the DFT divided by 2^exponent.
+// In fixed scaling each stage halves the data per factor of 2, as the
+// radix-2 version did, so the result is scaled by 1/N (the exponent is
+// log2_n). In block floating point (fft_block_float) each stage checks the
+// peak of its input and halves only as far as it needs to stay below 2^28.
+int FFTfix(fix15 fr[], fix15 fi[], int log2_n)
+{
+
+    int n = 1 << log2_n; // number of points
+    int s;               // index into the swap list
+    fix15 tr, ti;        // for temporary storage while swapping, and during iteration
+
+    int i, m;  // element and twiddle index of the butterflies
+    int L;     // length of the FFT's being combined
+    int istep; // length of the FFT which results from combining them
+
+    fix15 *w;     // twiddles of element m
+    fix15 qr, qi; // temporary variables for the radix-2 stage
+    fix15 br, bi; // quarters times their twiddles
+    fix15 cr, ci;
+    fix15 dr, di;
+
+    bool block = fft_block_float; // block floating point, for this FFT
+    int shift;                    // halvings in the current stage
+    int exponent = 0;             // halvings so far
+    fix15 peak = 0;               // OR of the magnitudes going into the current stage
+
+    //////////////////////////////////////////////////////////////////////////
+    ////////////////////////// BIT REVERSAL //////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
+    if (log2_n != fft_swaps_log2_n)
+        FFTswaps(log2_n);
+    for (s = 0; s < fft_n_swaps; s += 2)
+    {
         // swap the bit-reveresed indices
+        m = fft_swaps[s];
+        i = fft_swaps[s + 1];
         tr = fr[m];
-        fr[m] = fr[mr];
-        fr[mr] = tr;
+        fr[m] = fr[i];
+        fr[i] = tr;
         ti = fi[m];
-        fi[m] = fi[mr];
-        fi[mr] = ti;
+        fi[m] = fi[i];
+        fi[i] = ti;
+    }
+    // The first stage's peak comes from the input. Later ones come from
+    // the stage before, as it writes its output.
+    if (block)
+    {
+        for (i = 0; i < n; i++)
+            peak |= FFTpeak(fr[i]) | FFTpeak(fi[i]);
     }
     //////////////////////////////////////////////////////////////////////////
     ////////////////////////// Danielson-Lanczos //////////////////////////////
     //////////////////////////////////////////////////////////////////////////
-    // Adapted from code by:
-    // Tom Roberts 11/8/89 and Malcolm Slaney 12/15/94 malcolm@interval.com
     // Length of the FFT's being combined (starts at 1)
     L = 1;
-    // Log2 of number of samples, minus 1
-    k = LOG2_NUM_SAMPLES - 1;
-    // While the length of the FFT's being combined is less than the number
-    // of gathered samples . . .
-    while (L < NUM_SAMPLES)
+    // An odd power of two starts with a radix-2 stage. Its only twiddle is 1.
+    if (log2_n & 1)
+    {
+        shift = block ? FFTshift(peak, 26) : 1;
+        peak = 0;
+        for (i = 0; i < n; i += 2)
+        {
+            qr = fr[i] >> shift;
+            qi = fi[i] >> shift;
+            tr = fr[i + 1] >> shift;
+            ti = fi[i + 1] >> shift;
+            fr[i + 1] = qr - tr;
+            fi[i + 1] = qi - ti;
+            fr[i] = qr + tr;
+            fi[i] = qi + ti;
+            if (block)
+                peak |= FFTpeak(fr[i]) | FFTpeak(fi[i]) | FFTpeak(fr[i + 1]) | FFTpeak(fi[i + 1]);
+        }
+        exponent += shift;
+        L = 2;
+    }
+    // Radix-4 stages: combine four FFT's of length L into one of length 4L
+    while (L < n)
     {
-        // Determine the length of the FFT which will result from combining two FFT's
-        istep = L << 1;
-        // For each element in the FFT's that are being combined . . .
-        for (m = 0; m < L; ++m)
+        istep = L << 2;
+        shift = block ? FFTshift(peak, 24) : 2;
+        peak = 0;
+        // Element 0 of each group has no twiddles to multiply by
+        for (i = 0; i < n; i += istep)
+        {
+            peak |= FFTradix4(fr, fi, i, L, shift, block, fr[i], fi[i], fr[i + L], fi[i + L],
+                              fr[i + 2 * L], fi[i + 2 * L], fr[i + 3 * L], fi[i + 3 * L]);
+        }
+        // For each other element in the FFT's that are being combined . . .
+        for (m = 1; m < L; m++)
         {
             // Lookup the trig values for that element
-            j = m << k;                         // index of the sine table
-            wr = Sinewave[j + NUM_SAMPLES / 4]; // cos(2pi m/N)
-            wi = -Sinewave[j];                  // sin(2pi m/N)
-            wr >>= 1;                           // divide by two
-            wi >>= 1;                           // divide by two
-            // i gets the index of one of the FFT elements being combined
-            for (i = m; i < NUM_SAMPLES; i += istep)
+            w = fft_twiddle[L - 1 + m];
+            for (i = m; i < n; i += istep)
             {
-                // j gets the index of the FFT element being combined with i
-                j = i + L;
-                // compute the trig terms (bottom half of the above matrix)
-                tr = multfix15(wr, fr[j]) - multfix15(wi, fi[j]);
-                ti = multfix15(wr, fi[j]) + multfix15(wi, fr[j]);
-                // divide ith index elements by two (top half of above matrix)
-                qr = fr[i] >> 1;
-                qi = fi[i] >> 1;
-                // compute the new values at each index
-                fr[j] = qr - tr;
-                fi[j] = qi - ti;
-                fr[i] = qr + tr;
-                fi[i] = qi + ti;
+                // quarter 1 times W^2m, quarter 2 times W^m, quarter 3 times W^3m
+                br = multfix15(w[2], fr[i + L]) - multfix15(w[3], fi[i + L]);
+                bi = multfix15(w[2], fi[i + L]) + multfix15(w[3], fr[i + L]);
+                cr = multfix15(w[0], fr[i + 2 * L]) - multfix15(w[1], fi[i + 2 * L]);
+                ci = multfix15(w[0], fi[i + 2 * L]) + multfix15(w[1], fr[i + 2 * L]);
+                dr = multfix15(w[4], fr[i + 3 * L]) - multfix15(w[5], fi[i + 3 * L]);
+                di = multfix15(w[4], fi[i + 3 * L]) + multfix15(w[5], fr[i + 3 * L]);
+                peak |= FFTradix4(fr, fi, i, L, shift, block, fr[i], fi[i], br, bi, cr, ci, dr, di);
             }
         }
-        --k;
+        exponent += shift;
         L = istep;
     }
+    return exponent;
+}
+
+// FFT of N = 2^log2_n real samples (at most NUM_SAMPLES), computed as a
+// complex FFT of half the length. Pass the even samples in fr[0..N/2-1] and
+// the odd samples in fi[0..N/2-1]. Bins 0 to N/2 come back in fr and fi,
+// scaled by 1/N like FFTfix, for about half of FFTfix's butterflies on the
+// zero imaginary part.
+// In block floating point the scaling to 1/N is left to the last butterfly,
+// which rounds, so quiet input only loses bits there.
+void FFTreal(fix15 fr[], fix15 fi[], int log2_n)
+{
+
+    int k;        // bin being split out, along with bin N/2 - k
+    int kr;       // N/2 - k
+    fix15 ar, ai; // half-length spectrum at k
+    fix15 br, bi; // half-length spectrum at N/2 - k
+    fix15 ur, ui; // spectrum of the even samples at k
+    fix15 vr, vi; // spectrum of the odd samples at k
+    fix15 wr, wi; // trigonometric values from lookup table
+    fix15 tr, ti; // odd spectrum times the twiddle
+    int shift;    // halvings in the last butterfly
+    fix15 round;  // half of the last butterfly's step, or 0 to truncate
+    int n = 1 << log2_n;                // number of points
+    int step = NUM_SAMPLES >> log2_n;   // Sinewave entries per bin
+
+    // Transform the even/odd pairs as N/2 complex samples
+    shift = log2_n - FFTfix(fr, fi, log2_n - 1);
+    // The last butterfly halves once, plus whatever FFTfix skipped. If it
+    // halved more than fixed scaling would have, undo the difference now
+    // (the spectrum at 1/(N/2) is no larger than the input, so this fits).
+    if (shift < 1)
+    {
+        for (k = 0; k < (n >> 1); k++)
+        {
+            fr[k] <<= 1 - shift;
+            fi[k] <<= 1 - shift;
+        }
+        shift = 1;
+    }
+    round = fft_block_float ? 1 << (shift - 1) : 0;
+
+    // The real parts of that spectrum hold the even samples' spectrum and
+    // the imaginary parts the odd samples'. Split them using the symmetry of
+    // real input, then combine them with one more butterfly (which also
+    // halves, like each stage of FFTfix).
+    // Bin 0 gives DC and Nyquist
+    ar = fr[0];
+    ai = fi[0];
+    fr[0] = (ar + ai + round) >> shift;
+    fi[0] = 0;
+    fr[n >> 1] = (ar - ai + round) >> shift;
+    fi[n >> 1] = 0;
+    for (k = 1; k <= (n >> 2); k++)
+    {
+        kr = (n >> 1) - k;
+        ar = fr[k];
+        ai = fi[k];
+        br = fr[kr];
+        bi = fi[kr];
+        // even and odd spectra
+        ur = (ar + br) >> 1;
+        ui = (ai - bi) >> 1;
+        vr = (ai + bi) >> 1;
+        vi = (br - ar) >> 1;
+        // twiddle the odd spectrum by exp(-2pi k/N)
+        wr = Sinewave[k * step + NUM_SAMPLES / 4]; // cos(2pi k/N)
+        wi = -Sinewave[k * step];                  // sin(2pi k/N)
+        tr = multfix15(wr, vr) - multfix15(wi, vi);
+        ti = multfix15(wr, vi) + multfix15(wi, vr);
+        // bin k, and bin N/2 - k as its mirror image
+        fr[k] = (ur + tr + round) >> shift;
+        fi[k] = (ui + ti + round) >> shift;
+        fr[kr] = (ur - tr + round) >> shift;
+        fi[kr] = (ti - ui + round) >> shift;
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -883,6 +1214,11 @@ static PT_THREAD(protothread_serial(struct pt *pt))
             printf("splash\n\r");
             printf("from\n\n");
             printf("splashColor <float>\n\r");
+            printf("capture <frames, -1 = until 'capture 0'>\n\r");
+            printf("frames\n\r");
+            printf("hop <samples, multiple of %d up to the fftsize>\n\r", CAPTURE_BLOCK);
+            printf("blockfloat <0|1>\n\r");
+            printf("fftsize <256|512|1024>\n\r");
         }
         else if (strcmp(cmd, "from") == 0)
         {
@@ -947,6 +1283,8 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 }
 
                 curr_N_boids = (uint16_t)(atoi(arg1));
+                if (curr_N_boids > N_boids) curr_N_boids = N_boids;
+                tiles_redraw = true;
 
                 // Spawn boid flocks
                 for (uint16_t current_boid = 0; current_boid < curr_N_boids; current_boid++)
@@ -979,6 +1317,7 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 }
 
                 curr_N_predators = (uint16_t)(atoi(arg1));
+                tiles_redraw = true;
 
                 // Spawn boid flocks
                 for (uint16_t current_boid = 0; current_boid < curr_N_boids; current_boid++)
@@ -1064,6 +1403,67 @@ static PT_THREAD(protothread_serial(struct pt *pt))
                 Splash_Color = atof(arg1);
             }
         }
+        else if (strcmp(cmd, "frames") == 0)
+        {
+            // frame count, dropped vblanks, and frame-time histogram
+            vgaFramePrint(&anim_frames);
+            printf("sim=%uus tiles=%uus draw=%uus (%u of %u tiles changed)\n\r",
+                   sim_us, tile_sum_us, tile_draw_us, tiles_N_changed, MAX_TILES);
+        }
+        else if (strcmp(cmd, "hop") == 0)
+        {
+            // FFT window spacing, and how many windows were skipped so far
+            // (at most the FFT length, so that no samples go unanalyzed)
+            if (arg1 != NULL)
+            {
+                int hop = atoi(arg1);
+                if (hop >= CAPTURE_BLOCK && hop <= (1 << fft_log2_n) && hop % CAPTURE_BLOCK == 0)
+                {
+                    hop_samples = hop;
+                }
+            }
+            printf("hop=%u (%u%% overlap) skipped=%u\n\r", hop_samples,
+                   100 - 100 * hop_samples / (1 << fft_log2_n), capture_skipped);
+        }
+        else if (strcmp(cmd, "blockfloat") == 0)
+        {
+            // FFT scaling: block floating point (1) or halving at every stage (0)
+            if (arg1 != NULL)
+            {
+                fft_block_float = atoi(arg1) != 0;
+            }
+            printf("blockfloat=%d\n\r", fft_block_float);
+        }
+        else if (strcmp(cmd, "fftsize") == 0)
+        {
+            // FFT length for note detection. The hop is cut to the new
+            // length if it was longer, so no samples go unanalyzed.
+            if (arg1 != NULL)
+            {
+                int size = atoi(arg1);
+                for (int l = 8; l <= LOG2_NUM_SAMPLES; l++)
+                {
+                    if (size == (1 << l))
+                    {
+                        fft_log2_n = l;
+                        if (hop_samples > size)
+                        {
+                            hop_samples = size;
+                        }
+                    }
+                }
+            }
+            printf("fftsize=%d (%d ms) hop=%u\n\r", 1 << fft_log2_n,
+                   (int)(1000 * (1 << fft_log2_n) / Fs), hop_samples);
+        }
+        else if (strcmp(cmd, "capture") == 0)
+        {
+            // stream frames to vga_capture.py over the USB port
+            if (arg1 != NULL)
+            {
+                vga_capture_frames = atoi(arg1);
+            }
+        }
         else
             printf("Huh?\n\r");
     } // END WHILE(1)
@@ -1073,6 +1473,112 @@ static PT_THREAD(protothread_serial(struct pt *pt))
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Queue a tile for the color pass
+static inline void tile_touch(uint16_t t)
+{
+    if (!tiles[t].dirty)
+    {
+        tiles[t].dirty = true;
+        tiles_dirty[tiles_N_dirty++] = t;
+    }
+}
+
+// Tile under a boid, clamped to the grid so that a stray position can never
+// index outside tiles[]
+static inline uint16_t tile_of(uint16_t curr_boid)
+{
+    int col = fix2int15(boid_flock[curr_boid].x) >> TILE_SHIFT;
+    int row = fix2int15(boid_flock[curr_boid].y) >> TILE_SHIFT;
+    if (col < 0) col = 0;
+    if (col > TILES_WIDE - 1) col = TILES_WIDE - 1;
+    if (row < 0) row = 0;
+    if (row > TILES_HIGH - 1) row = TILES_HIGH - 1;
+    return (uint16_t)(row * TILES_WIDE + col);
+}
+
+// Take a boid out of the tile it is counted in
+static inline void tile_remove(uint16_t curr_boid)
+{
+    uint16_t t = boid_tile[curr_boid];
+    if (t == TILE_NONE) return;
+    tiles[t].total_hue -= boid_tile_hue[curr_boid];
+    tiles[t].num_boids--;
+    boid_tile[curr_boid] = TILE_NONE;
+    tile_touch(t);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bring the tile sums up to date with the boids that moved tile or changed
+// hue this frame
+void tiles_update()
+{
+    // Boids dropped by numberBoids leave their tiles
+    uint16_t n = curr_N_boids;
+    for (uint16_t current_boid = n; current_boid < tiles_N_boids; current_boid++)
+    {
+        tile_remove(current_boid);
+    }
+    tiles_N_boids = n;
+
+    for (uint16_t current_boid = 0; current_boid < n; current_boid++)
+    {
+        uint16_t t = tile_of(current_boid);
+        int hue = boid_flock[current_boid].hue;
+        if (t == boid_tile[current_boid] && hue == boid_tile_hue[current_boid]) continue;
+
+        tile_remove(current_boid);
+        tiles[t].total_hue += hue;
+        tiles[t].num_boids++;
+        boid_tile[current_boid] = t;
+        boid_tile_hue[current_boid] = hue;
+        tile_touch(t);
+    }
+
+    // Empty tiles show the overall mood, so a new mood touches all of them
+    int mood_now = overall_mood;
+    if (mood_now != tiles_mood || tiles_redraw)
+    {
+        for (uint16_t t = 0; t < MAX_TILES; t++)
+        {
+            if (tiles[t].num_boids == 0 || tiles_redraw) tile_touch(t);
+        }
+        tiles_mood = mood_now;
+    }
+}
+
+// Recolor the touched tiles, list the ones whose color changed, and draw them
+void tiles_draw()
+{
+    bool redraw = tiles_redraw;
+    tiles_redraw = false;
+    tiles_N_changed = 0;
+    for (uint16_t d = 0; d < tiles_N_dirty; d++)
+    {
+        uint16_t t = tiles_dirty[d];
+        tiles[t].dirty = false;
+
+        int avg_hue = tiles[t].num_boids > 0 ? tiles[t].total_hue / tiles[t].num_boids : tiles_mood;
+        unsigned int tile_color = hsv2rgb24(avg_hue, 0.75, 1);
+        if (tile_color == tiles[t].color && !redraw) continue;
+
+        tiles[t].color = tile_color;
+        tiles_changed[tiles_N_changed++] = t;
+    }
+    tiles_N_dirty = 0;
+
+    for (uint16_t c = 0; c < tiles_N_changed; c++)
+    {
+        uint16_t t = tiles_changed[c];
+        // Ordered dither gives the tiles many more apparent hues than the 8-bit palette
+        fillRectBayer(tiles[t].x, tiles[t].y, TILE_SIDE, TILE_SIDE, tiles[t].color);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 // Animation on core 0
 static PT_THREAD(protothread_anim(struct pt *pt))
 {
@@ -1082,7 +1588,8 @@ static PT_THREAD(protothread_anim(struct pt *pt))
     // Variables for maintaining frame rate
     int begin_time;
     int spare_time;
-    char color_to_draw = hsv2rgb(120, 0.75, 1);
+    unsigned int sim_done;
+    unsigned int sum_done;
 
     // Spawn boid flocks
     for (uint16_t current_boid = 0; current_boid < curr_N_boids; current_boid++)
@@ -1161,26 +1668,6 @@ static PT_THREAD(protothread_anim(struct pt *pt))
             // Update boid state
             boid_algo_update(current_boid);
 
-            int col = (int)(fix2int15(boid_flock[current_boid].x) / tile_side);
-            int row = (int)(fix2int15(boid_flock[current_boid].y) / tile_side);
-
-            int tile_index = row * width + col;
-            // if (tile_index >= total_tiles) {
-            //     tile_index = total_tiles - 1;
-            // }
-            if (tile_index > total_tiles) printf("%d\n", tile_index);
-            if (tile_index < 0) printf("%d\n", tile_index);
-            // printf("tile index =%d\n", tile_index);
-            // printf("boid hue %d\n",boid_flock[current_boid].hue);
-            tiles[tile_index].total_hue += boid_flock[current_boid].hue;
-            tiles[tile_index].num_boids++;
-            // if (tiles[tile_index].total_hue > 2000)
-            // {
-            //     printf("boid hue %d\n", boid_flock[current_boid].hue);
-            //     printf("total hue %d\n", tiles[tile_index].total_hue);
-            //     printf("num boids %d\n", tiles[tile_index].num_boids);
-            // }
-
             // char color_to_draw = hsv2rgb(boid_flock[current_boid].hue, 1, 1);
             // fillCircle(fix2int15(boid_flock[current_boid].x), fix2int15(boid_flock[current_boid].y), size_circle, color_to_draw);
 
@@ -1202,104 +1689,22 @@ static PT_THREAD(protothread_anim(struct pt *pt))
             boid_flock[current_boid].num_predators = 0;
         }
 
-        // printf("boid Calc Done\n");
-        // char color_to_draw = hsv2rgb(120, 1, 1);
-        // printf("boid Calc Done\n");
-
-        
-        for (int i = 0; i < total_tiles; i++)
-        {
-            // printf("in for\n");
-            // Do color processing
-            int num_boids = tiles[i].num_boids;
-
-            // if (tiles[i].x == 0 && tiles[i].y == 0)
-            // {
-            //     printf("Is x crashing?");
-            //     printf("tile x %d\n", tiles[i].x);
-            //     printf("Is y crashing?");
-            //     printf("tile y %d\n", tiles[i].y);
-            //     printf("color to draw %d\n",color_to_draw);
-                
-            // }
-
-            if (color_to_draw == 220) error = 1;
-
-            // if (error)
-            // {
-            //     printf("tile x %d\n", tiles[i].x);
-            //     printf("tile y %d\n", tiles[i].y);
-            //     printf("color to draw %d\n",color_to_draw);
-            //     printf("Color was 220 before if\n");
-            // }
-
-            ///
-            // char color_to_draw;// = hsv2rgb(120, 1, 1);
-            if (num_boids > 0)
-            {
-                // if (error) printf("in if\n");
-                // printf("in if\n");
-                int avg_hue = tiles[i].total_hue / tiles[i].num_boids;
-                color_to_draw = hsv2rgb(avg_hue, 0.75, 1);
-                // if (color_to_draw == 0)
-                // {
-                //     printf("color = %d\n", color_to_draw);
-                //     printf("avg hue %d\n", avg_hue);
-                //     printf("num num boids %d\n", tiles[i].num_boids);
-                //     printf("total hue %d\n", tiles[i].total_hue);
-                // }
-                // printf("avg hue %d\n", avg_hue);
-                // printf("num boids %d\n", tiles[i].num_boids);
-            }
-            else
-            {
-                // if (error) printf("in else\n");
-                // printf("in else\n");
-                // printf("overall mood %d\n", overall_mood);
-                // if (error == 1) printf("overall mood %d\n", overall_mood);
-                color_to_draw = hsv2rgb(overall_mood, 0.75, 1);
-                // if (color_to_draw == 0)
-                // {
-                //     printf("color = %d\n", color_to_draw);
-                //     printf("overall mood %d\n", overall_mood);
-                // }
-                // if (error == 1) printf("color to draw %d\n",color_to_draw);
-                // color_to_draw = rgb(7,0,0);
-            }
-            /////
-
-            //printf("before fillRect\n");
-            
-            // color_to_draw = hsv2rgb(120, 1, 1);
-            // printf("predators = %d\n", curr_N_predators);
-            
-
-            // if (error)
-            // {
-            //     printf("tile x %d\n", tiles[i].x);
-            //     printf("tile y %d\n", tiles[i].y);
-            //     printf("color to draw %d\n",color_to_draw);
-            //     printf("Color was 220 after if\n");
-            // }
-            
-            
-            
-            fillRect(tiles[i].x, tiles[i].y, tile_side, tile_side, color_to_draw);
-            // printf("i %d\n", i);
-            // if (error) printf("filled rectangle\n");
-
-            /////
-            tiles[i].total_hue = 0;
-            tiles[i].num_boids = 0;
-
-        }
+        // Tiles, timed apart from the simulation
+        sim_done = time_us_32();
+        tiles_update();
+        sum_done = time_us_32();
+        tiles_draw();
+        sim_us = sim_done - begin_time;
+        tile_sum_us = sum_done - sim_done;
+        tile_draw_us = time_us_32() - sum_done;
 
         // printf("Tile Calc Done\n");
         // char color_to_draw = hsv2rgb(120, 1, 1);
         // fillRect(5, 5, 20, 20, color_to_draw);
 
         spare_time = FRAME_RATE - (time_us_32() - begin_time);
-        PT_YIELD_usec(100);
+        // Yield until this frame's vblank
+        PT_YIELD_VBLANK(pt, &anim_frames, FRAME_VBLANKS);
 
         // printf("Spare Time Done\n");
 
@@ -1311,6 +1716,30 @@ static PT_THREAD(protothread_anim(struct pt *pt))
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// A capture block is full: count it, and point the channel that filled it
+// at its next block, two on (the other channel is filling the one between).
+// The transfer count reloads when the other channel chains to it.
+void captureHandler()
+{
+    int ch[2] = {sample_chan_a, sample_chan_b};
+    uint8_t *next;
+    for (int k = 0; k < 2; k++)
+    {
+        if (dma_hw->ints1 & (1u << ch[k]))
+        {
+            dma_hw->ints1 = 1u << ch[k];
+            capture_count += CAPTURE_BLOCK;
+            next = (uint8_t *)dma_hw->ch[ch[k]].write_addr + CAPTURE_BLOCK;
+            if (next >= sample_array + CAPTURE_SAMPLES)
+                next -= CAPTURE_SAMPLES;
+            dma_channel_set_write_addr(ch[k], next, false);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 // fft on core 1
 static PT_THREAD(protothread_FFT(struct pt *pt))
 {
@@ -1320,51 +1749,61 @@ static PT_THREAD(protothread_FFT(struct pt *pt))
     ///////////////////////////////////////////////////////////////////////////
     // For Music
 
-    // Start the ADC channel
-    dma_start_channel_mask((1u << sample_chan));
+    // Start the first ADC channel (the second follows by chaining)
+    dma_start_channel_mask((1u << sample_chan_a));
     // Start the ADC
     adc_run(true);
 
     // Declare some static variables
     static int height;         // for scaling display
-    static float max_freqency; // holds max frequency
     static int i;              // incrementing loop variable
+    static int log2_n;         // FFT length for this window, as log2
+    static int n;              // FFT length
+    static int step;           // window stride for that length
 
-    // static fix15 max_fr;   // temporary variable for max freq calculation
-    static int max_fr_dex; // index of max frequency
+    static unsigned int analyzed = 0; // capture_count at the end of the last window
+    static unsigned int now;          // capture_count at the end of this window
+    static unsigned int start;        // ring index of this window's first sample
 
     ///////////////////////////////////////////////////////////////////////////
 
     while (1)
     {
-        PT_YIELD_usec(1000);
         ////////////////////////////////////////////////////////////////////////
         ////////////////////////////////////////////////////////////////////////
         // For Music
 
-        // Wait for NUM_SAMPLES samples to be gathered
-        // Measure wait time with timer. THIS IS BLOCKING
-        dma_channel_wait_for_finish_blocking(sample_chan);
-
-        // Copy/window elements into a fixed-point array
-        for (i = 0; i < NUM_SAMPLES; i++)
+        // Wait for a hop's worth of new samples. The DMA keeps filling the
+        // ring meanwhile, so none are lost however long the last frame took.
+        PT_YIELD_UNTIL(pt, capture_count >= (1u << fft_log2_n) &&
+                               capture_count - analyzed >= hop_samples);
+        // The window always ends at the newest block. If more than a hop
+        // has gone by, the windows in between are skipped.
+        now = capture_count;
+        if (analyzed && now - analyzed >= 2 * hop_samples)
         {
-            fr[i] = multfix15(int2fix15((int)sample_array[i]), window[i]);
-            fi[i] = (fix15)0;
+            capture_skipped += (now - analyzed) / hop_samples - 1;
+        }
+        analyzed = now;
+        log2_n = fft_log2_n;
+        n = 1 << log2_n;
+        step = NUM_SAMPLES >> log2_n;
+        start = (now - n) & (CAPTURE_SAMPLES - 1);
+
+        // Copy/window elements into a fixed-point array, even samples to
+        // fr and odd samples to fi for the real FFT. A shorter FFT takes
+        // every step'th point of the window.
+        for (i = 0; i < (n >> 1); i++)
+        {
+            fr[i] = multfix15(int2fix15(((int)sample_array[(start + 2 * i) & (CAPTURE_SAMPLES - 1)] - ADC_MIDSCALE)), window[2 * i * step]);
+            fi[i] = multfix15(int2fix15(((int)sample_array[(start + 2 * i + 1) & (CAPTURE_SAMPLES - 1)] - ADC_MIDSCALE)), window[(2 * i + 1) * step]);
         }
-
-        // Zero max frequency and max frequency index
-        max_fr = 0;
-        max_fr_dex = 0;
-
-        // Restart the sample channel, now that we have our copy of the samples
-        dma_channel_start(control_chan);
 
         // Compute the FFT
-        FFTfix(fr, fi);
+        FFTreal(fr, fi, log2_n);
 
         // Find the magnitudes (alpha max plus beta min)
-        for (int i = 0; i < (NUM_SAMPLES >> 1); i++)
+        for (int i = 0; i < (n >> 1); i++)
         {
             // get the approx magnitude
             fr[i] = abs(fr[i]);
@@ -1372,20 +1811,12 @@ static PT_THREAD(protothread_FFT(struct pt *pt))
             // reuse fr to hold magnitude
             fr[i] = max(fr[i], fi[i]) +
                     multfix15(min(fr[i], fi[i]), zero_point_4);
-            // Keep track of top 3
-            if (fr[i] > max_fr && i > 4)
-            {
-                max_fr = fr[i];
-                // printf("mag = %d\n",fix2int15(max_fr));
-                max_fr_dex = i;
-                current_loudest_3_notes[2].mag = current_loudest_3_notes[1].mag;
-                current_loudest_3_notes[1].mag = current_loudest_3_notes[0].mag;
-                current_loudest_3_notes[0].mag = max_fr;
-                current_loudest_3_notes[2].freq = current_loudest_3_notes[1].freq;
-                current_loudest_3_notes[1].freq = current_loudest_3_notes[0].freq;
-                current_loudest_3_notes[0].freq = int2fix15(i);
-            }
         }
+
+        // Top 3 peaks, with their frequencies in Hz
+        find_peaks(fr, (int)(PEAK_MIN_FREQ * n / Fs) + 1, (n >> 1) - 2, log2_n,
+                   current_loudest_3_notes, 3);
+        max_fr = current_loudest_3_notes[0].mag;
         // printf("Amp = ");
         // printf("%d\n\r", current_loudest_3_notes[0].mag);
         percent_diff = divfix(current_loudest_3_notes[0].mag - old_note_mag, old_note_mag);
@@ -1401,9 +1832,6 @@ static PT_THREAD(protothread_FFT(struct pt *pt))
         else if (abs(percent_diff) > percent_diff_threshold)
         { // These are two different situations
             old_note_mag = current_loudest_3_notes[0].mag;
-            current_loudest_3_notes[0].freq = multfix15(current_loudest_3_notes[0].freq, freq_calc);
-            current_loudest_3_notes[1].freq = multfix15(current_loudest_3_notes[1].freq, freq_calc);
-            current_loudest_3_notes[2].freq = multfix15(current_loudest_3_notes[2].freq, freq_calc);
             curr_N_predators = music_stuff();
             // curr_N_predators = 1;
             turn_on_predator = true;
@@ -1513,6 +1941,8 @@ int main()
 
     // initialize stio
     stdio_init_all();
+    // USB port carries only captured frames
+    vgaCaptureInit();
 
     // initialize VGA
     initVGA();
@@ -1558,55 +1988,61 @@ int main()
         Sinewave[ii] = float2fix15(sin(6.283 * ((float)ii) / (float)NUM_SAMPLES));
         window[ii] = float2fix15(0.5 * (1.0 - cos(6.283 * ((float)ii) / ((float)NUM_SAMPLES))));
     }
+    // and the FFT's twiddle table
+    FFTinit();
 
     /////////////////////////////////////////////////////////////////////////////////
     // ============================== ADC DMA CONFIGURATION =========================
     /////////////////////////////////////////////////////////////////////////////////
 
     // Channel configurations
-    dma_channel_config c2 = dma_channel_get_default_config(sample_chan);
-    dma_channel_config c3 = dma_channel_get_default_config(control_chan);
+    dma_channel_config c2 = dma_channel_get_default_config(sample_chan_a);
+    dma_channel_config c3 = dma_channel_get_default_config(sample_chan_b);
 
-    // ADC SAMPLE CHANNEL
+    // ADC SAMPLE CHANNELS
     // Reading from constant address, writing to incrementing byte addresses
     channel_config_set_transfer_data_size(&c2, DMA_SIZE_8);
     channel_config_set_read_increment(&c2, false);
     channel_config_set_write_increment(&c2, true);
     // Pace transfers based on availability of ADC samples
     channel_config_set_dreq(&c2, DREQ_ADC);
-    // Configure the channel
-    dma_channel_configure(sample_chan,
+    // The second channel is the same, and each starts the other when done
+    c3 = c2;
+    channel_config_set_chain_to(&c2, sample_chan_b);
+    channel_config_set_chain_to(&c3, sample_chan_a);
+    // Configure the channels, for the first two blocks of the ring
+    dma_channel_configure(sample_chan_a,
                           &c2,           // channel config
                           sample_array,  // dst
                           &adc_hw->fifo, // src
-                          NUM_SAMPLES,   // transfer count
+                          CAPTURE_BLOCK, // transfer count
                           false          // don't start immediately
     );
-
-    // CONTROL CHANNEL
-    channel_config_set_transfer_data_size(&c3, DMA_SIZE_32); // 32-bit txfers
-    channel_config_set_read_increment(&c3, false);           // no read incrementing
-    channel_config_set_write_increment(&c3, false);          // no write incrementing
-    channel_config_set_chain_to(&c3, sample_chan);           // chain to sample chan
-
-    dma_channel_configure(
-        control_chan,                        // Channel to be configured
-        &c3,                                 // The configuration we just created
-        &dma_hw->ch[sample_chan].write_addr, // Write address (channel 0 read address)
-        &sample_address_pointer,             // Read address (POINTER TO AN ADDRESS)
-        1,                                   // Number of transfers, in this case each is 4 byte
-        false                                // Don't start immediately.
+    dma_channel_configure(sample_chan_b,
+                          &c3,                          // channel config
+                          sample_array + CAPTURE_BLOCK, // dst
+                          &adc_hw->fifo,                // src
+                          CAPTURE_BLOCK,                // transfer count
+                          false                         // don't start immediately
     );
 
+    // Interrupt at the end of each block, to count it and re-arm its channel
+    dma_channel_set_irq1_enabled(sample_chan_a, true);
+    dma_channel_set_irq1_enabled(sample_chan_b, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, captureHandler);
+    irq_set_enabled(DMA_IRQ_1, true);
+
     ////////////////////////////////////////////////////////////////////////////////
 
-    for (int i = 0; i < total_tiles; i++)
+    for (int i = 0; i < MAX_TILES; i++)
+    {
+        tiles[i].x = (i % TILES_WIDE) << TILE_SHIFT;
+        tiles[i].y = (i / TILES_WIDE) << TILE_SHIFT;
+        tiles[i].color = TILE_COLOR_NONE;
+    }
+    for (int i = 0; i < N_boids; i++)
     {
-        // Do color processing
-        int row = i / width;
-        int col = i - row * width;
-        tiles[i].x = col * tile_side;
-        tiles[i].y = row * tile_side;
+        boid_tile[i] = TILE_NONE;
     }
 
 
@@ -1617,6 +2053,7 @@ int main()
     // add threads
     pt_add_thread(protothread_serial);
     pt_add_thread(protothread_anim);
+    pt_add_thread(protothread_capture);
     // pt_add_thread(protothread_toggle25);
 
     // start scheduler
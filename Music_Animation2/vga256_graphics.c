@@ -4,6 +4,7 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
 // Our assembled programs:
 // Each gets the name <pio_filename.pio.h>
 #include "hsync.pio.h"
@@ -29,10 +30,22 @@
 // Pixel color array that is DMA's to the PIO machines and
 // a pointer to the ADDRESS of this color array.
 // Note that this array is automatically initialized to all 0's (black)
-unsigned char vga_data_array[TXCOUNT];
+// (word aligned so that fills can write four pixels at a time)
+unsigned char vga_data_array[TXCOUNT] __attribute__((aligned(4)));
 // points to address storing pointer to screen array
 char * address_pointer = &vga_data_array[0] ;
 
+// Frame service: the vsync machine raises PIO irq 3 once the last active
+// line is over, and this interrupt counts frames and timestamps vblank
+volatile unsigned int vga_frame_count = 0 ;
+volatile unsigned int vga_vblank_time = 0 ;
+
+static void __not_in_flash_func(vsyncHandler)(void) {
+    pio_interrupt_clear(pio0, 3) ;
+    vga_vblank_time = time_us_32() ;
+    vga_frame_count++ ;
+}
+
 // For drawLine
 #define swap(a, b) { short t = a; a = b; b = t; }
 
@@ -50,6 +63,18 @@ char textcolor, textbgcolor, wrap;
 #define _width 640
 #define _height 480
 
+// Framebuffer width/height (one byte per pixel)
+#define FB_WIDTH  320
+#define FB_HEIGHT 240
+
+// 4x4 Bayer threshold matrix for ordered dithering
+static const unsigned char bayer4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+} ;
+
 void initVGA() {
         // Choose which PIO instance to use (there are two instances, each with 4 state machines)
     PIO pio = pio0;
@@ -83,6 +108,12 @@ void initVGA() {
     vsync_program_init(pio, vsync_sm, vsync_offset, VSYNC);
     rgb_program_init(pio, rgb_sm, rgb_offset, 8); //8
     rgb_program_init(pio, rgb_sm3, rgb2_offset, 8); //8
+
+    // Count frames on the vsync machine's start-of-vblank irq
+    pio_set_irq0_source_enabled(pio, pis_interrupt3, true) ;
+    irq_set_exclusive_handler(PIO0_IRQ_0, vsyncHandler) ;
+    irq_set_enabled(PIO0_IRQ_0, true) ;
+
     // Start the two pio machine IN SYNC
     // Note that the RGB state machine is running at full speed,
     // so synchronization doesn't matter for that one. But, we'll
@@ -177,6 +208,52 @@ void initVGA() {
 }
 
 
+// Frame service. Call vgaFrameDone() when a frame is drawn, wait for
+// vga_frame_count to reach frames->target, then call vgaFrameStart().
+// PT_YIELD_VBLANK in vga_graphics.h does all three.
+void vgaFrameDone(struct vga_frames *frames, unsigned int interval) {
+    /* Parameters:
+        frames:   frame statistics for one animation loop
+        interval: vblanks per animation frame (1 = 60 fps, 2 = 30 fps, ...)
+    */
+    unsigned int now = vga_frame_count ;
+    if (frames->frames == 0) {
+        // first frame, nothing to be late for
+        frames->target = now + 1 ;
+        return ;
+    }
+    frames->busy_us = time_us_32() - frames->start_us ;
+    frames->target += interval ;
+    if ((int)(now - frames->target) >= 0) {
+        // the target vblank already went by, so show this frame at the next one
+        frames->overruns += now - frames->target + 1 ;
+        frames->target = now + 1 ;
+    }
+}
+
+void vgaFrameStart(struct vga_frames *frames) {
+    unsigned int now = time_us_32() ;
+    if (frames->frames > 0) {
+        unsigned int bin = (now - frames->start_us) / VGA_FRAME_HIST_US ;
+        if (bin >= VGA_FRAME_HIST_BINS) bin = VGA_FRAME_HIST_BINS - 1 ;
+        frames->histogram[bin]++ ;
+    }
+    // measure the next interval from the vblank we actually woke on
+    frames->target = vga_frame_count ;
+    frames->start_us = now ;
+    frames->frames++ ;
+}
+
+void vgaFramePrint(struct vga_frames *frames) {
+    printf("frames=%u overruns=%u busy=%uus\n\r", frames->frames, frames->overruns, frames->busy_us) ;
+    for (int i = 0; i < VGA_FRAME_HIST_BINS; i++) {
+        if (frames->histogram[i] == 0) continue ;
+        printf("%s%2d-%2d ms: %u\n\r", (i == VGA_FRAME_HIST_BINS - 1) ? ">=" : "  ",
+               i * VGA_FRAME_HIST_US / 1000, (i + 1) * VGA_FRAME_HIST_US / 1000, frames->histogram[i]) ;
+    }
+}
+
+
 // A function for drawing a pixel with a specified color.
 // Note that because information is passed to the PIO state machines through
 // a DMA channel, we only need to modify the contents of the array and the
@@ -196,6 +273,11 @@ void drawPixel(short x, short y, char color) {
     vga_data_array[pixel] = color ;  
 }
 
+// Draw a pixel from a checkerboard of two colors
+void drawPixelDither(short x, short y, char color1, char color2) {
+    drawPixel(x, y, ((x ^ y) & 1) ? color2 : color1) ;
+}
+
 
 void drawVLine(short x, short y, short h, char color) {
     for (short i=y; i<(y+h); i++) {
@@ -281,6 +363,18 @@ void drawRect(short x, short y, short w, short h, char color) {
   drawVLine(x+w-1, y, h, color);
 }
 
+// Draw a rectangle outline from a checkerboard of two colors
+void drawRectDither(short x, short y, short w, short h, char color1, char color2) {
+  for (short i=x; i<(x+w); i++) {
+    drawPixelDither(i, y, color1, color2) ;
+    drawPixelDither(i, y+h-1, color1, color2) ;
+  }
+  for (short j=y; j<(y+h); j++) {
+    drawPixelDither(x, j, color1, color2) ;
+    drawPixelDither(x+w-1, j, color1, color2) ;
+  }
+}
+
 void drawCircle(short x0, short y0, short r, char color) {
 /* Draw a circle outline with center (x0,y0) and radius r, with given color
  * Parameters:
@@ -361,6 +455,71 @@ void drawCircleHelper( short x0, short y0, short r, unsigned char cornername, ch
   }
 }
 
+// Filled circles up to this radius are drawn from cached span tables
+#define SPAN_TABLE_MAX 16
+
+// Half-width of each row of a filled circle, by radius and row offset
+// from the center. Built on first use from the same midpoint-circle steps
+// as fillCircleHelper, so both paths cover exactly the same pixels.
+static unsigned char span_table[SPAN_TABLE_MAX + 1][SPAN_TABLE_MAX + 1] ;
+static volatile unsigned int span_table_ready = 0 ;
+
+static const unsigned char * circleSpans(short r) {
+  if (!(span_table_ready & (1u << r))) {
+    unsigned char height[SPAN_TABLE_MAX + 1] = {0} ;
+    short f     = 1 - r;
+    short ddF_x = 1;
+    short ddF_y = -2 * r;
+    short x     = 0;
+    short y     = r;
+
+    // half-height of each column
+    height[0] = r ;
+    while (x<y) {
+      if (f >= 0) {
+        y--;
+        ddF_y += 2;
+        f     += ddF_y;
+      }
+      x++;
+      ddF_x += 2;
+      f     += ddF_x;
+      if (y > height[x]) height[x] = y ;
+      if (x > height[y]) height[y] = x ;
+    }
+    // half-width of each row is the widest column that reaches it
+    for (short dy = 0; dy <= r; dy++) {
+      unsigned char w = 0 ;
+      for (short c = 0; c <= r; c++) {
+        if (height[c] >= dy) w = c ;
+      }
+      span_table[r][dy] = w ;
+    }
+    span_table_ready |= (1u << r) ;
+  }
+  return span_table[r] ;
+}
+
+// Fill pixels x0 through x1 of row y, clipped to the screen. Pixels are
+// written four at a time (one word) where the span covers a whole aligned word.
+static void fillSpan(short x0, short x1, short y, char color) {
+  if ((y < 0) || (y > 239)) return ;
+  if (x0 < 0) x0 = 0 ;
+  if (x1 > 315) x1 = 315 ;
+  if (x0 > x1) return ;
+
+  unsigned char *row = &vga_data_array[320 * y] ;
+  int i = x0 ;
+  int end = x1 + 1 ;
+  unsigned int word = (unsigned char)color * 0x01010101u ;
+  while ((i < end) && (i & 3)) row[i++] = color ;
+  while (i + 4 <= end) {
+    *(unsigned int *)&row[i] = word ;
+    i += 4 ;
+  }
+  while (i < end) row[i++] = color ;
+}
+
 void fillCircle(short x0, short y0, short r, char color) {
 /* Draw a filled circle with center (x0,y0) and radius r, with given color
  * Parameters:
@@ -372,8 +531,19 @@ void fillCircle(short x0, short y0, short r, char color) {
  *      color: 16-bit color value for the circle
  * Returns: Nothing
  */
-  drawVLine(x0, y0-r, 2*r+1, color);
-  fillCircleHelper(x0, y0, r, 3, 0, color);
+  if ((r < 0) || (r > SPAN_TABLE_MAX)) {
+    drawVLine(x0, y0-r, 2*r+1, color);
+    fillCircleHelper(x0, y0, r, 3, 0, color);
+    return ;
+  }
+
+  // small circles: one horizontal span per row
+  const unsigned char *span = circleSpans(r) ;
+  fillSpan(x0 - span[0], x0 + span[0], y0, color) ;
+  for (short dy = 1; dy <= r; dy++) {
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 - dy, color) ;
+    fillSpan(x0 - span[dy], x0 + span[dy], y0 + dy, color) ;
+  }
 }
 
 void fillCircleHelper(short x0, short y0, short r, unsigned char cornername, short delta, char color) {
@@ -433,6 +603,21 @@ void drawRoundRect(short x, short y, short w, short h, short r, char color) {
 
 // Fill a rounded rectangle
 void fillRoundRect(short x, short y, short w, short h, short r, char color) {
+  if ((r >= 0) && (r <= SPAN_TABLE_MAX) && (w > 2*r) && (h > 2*r)) {
+    // small corners: one horizontal span per row
+    const unsigned char *span = circleSpans(r) ;
+    short top = y + r ;
+    short bottom = y + h - r - 1 ;
+    for (short j = top; j <= bottom; j++) {
+      fillSpan(x, x + w - 1, j, color) ;
+    }
+    for (short dy = 1; dy <= r; dy++) {
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], top - dy, color) ;
+      fillSpan(x + r - span[dy], x + w - r - 1 + span[dy], bottom + dy, color) ;
+    }
+    return ;
+  }
+
   // smarter version
   fillRect(x+r, y, w-2*r, h, color);
 
@@ -482,6 +667,89 @@ void fillRectDither(short x, short y, short w, short h, char color1, char color2
   }
 }
 
+// ==================================================
+// === ordered (Bayer) dither engine
+// ==================================================
+// Build one 32-bit word (four pixels) per row of the 4x4 Bayer
+// matrix. Each channel is rounded to the palette level just below
+// and just above the target, and the matrix decides which one a
+// pixel gets, so the area average lands on the 24-bit color.
+void bayerPattern(unsigned int color24, unsigned int pattern[4]) {
+  int r = (color24 >> 16) & 0xff ;
+  int g = (color24 >> 8) & 0xff ;
+  int b = color24 & 0xff ;
+  // palette has 8 red, 8 green and 4 blue levels
+  int r_lo = (r * 7) / 255, r_frac = (r * 7) - (r_lo * 255) ;
+  int g_lo = (g * 7) / 255, g_frac = (g * 7) - (g_lo * 255) ;
+  int b_lo = (b * 3) / 255, b_frac = (b * 3) - (b_lo * 255) ;
+
+  for (int row=0; row<4; row++) {
+    pattern[row] = 0 ;
+    for (int col=0; col<4; col++) {
+      // threshold in the same 0-255 range as the fractions
+      int t = (bayer4[row][col] << 4) + 8 ;
+      unsigned char pixel = rgb(r_lo + (r_frac > t),
+                                g_lo + (g_frac > t),
+                                b_lo + (b_frac > t)) ;
+      pattern[row] |= ((unsigned int)pixel) << (col << 3) ;
+    }
+  }
+}
+
+// fill a rectangle with an ordered-dithered 24-bit color
+void fillRectBayer(short x, short y, short w, short h, unsigned int color24) {
+/* Draw a filled rectangle with starting top-left vertex (x,y),
+ *  width w and height h, approximating a 24-bit color with a
+ *  4x4 Bayer pattern of the two nearest palette levels
+ * Parameters:
+ *      x:  x-coordinate of top-left vertex; top left of screen is x=0
+ *              and x increases to the right
+ *      y:  y-coordinate of top-left vertex; top left of screen is y=0
+ *              and y increases to the bottom
+ *      w:  width of rectangle
+ *      h:  height of rectangle
+ *      color24:  0xRRGGBB color, see rgb24()
+ * Returns:     Nothing
+ */
+  unsigned int pattern[4] ;
+  bayerPattern(color24, pattern) ;
+  fillRectPattern(x, y, w, h, pattern) ;
+}
+
+// fill a rectangle with a pre-computed 4x4 pattern (see bayerPattern)
+void fillRectPattern(short x, short y, short w, short h, unsigned int pattern[4]) {
+  // clip to the framebuffer
+  int x0 = (x < 0) ? 0 : x ;
+  int y0 = (y < 0) ? 0 : y ;
+  int x1 = ((x + w) > FB_WIDTH) ? FB_WIDTH : (x + w) ;
+  int y1 = ((y + h) > FB_HEIGHT) ? FB_HEIGHT : (y + h) ;
+  if ((x0 >= x1) || (y0 >= y1)) return ;
+
+  // whole words between the first and last aligned pixel
+  int xa = (x0 + 3) & ~3 ;
+  int xb = x1 & ~3 ;
+  if (xa > xb) xa = xb = x1 ;
+
+  for (int j=y0; j<y1; j++) {
+    unsigned int word = pattern[j & 3] ;
+    unsigned char *row = &vga_data_array[FB_WIDTH * j] ;
+    int i ;
+    // leading pixels
+    for (i=x0; i<xa; i++) {
+      row[i] = word >> ((i & 3) << 3) ;
+    }
+    // four pixels per write
+    unsigned int *words = (unsigned int *)&row[xa] ;
+    for (i=xa; i<xb; i+=4) {
+      *words++ = word ;
+    }
+    // trailing pixels
+    for (i=xb; i<x1; i++) {
+      row[i] = word >> ((i & 3) << 3) ;
+    }
+  }
+}
+
 // Draw a character
 void drawChar(short x, short y, unsigned char c, char color, char bg, unsigned char size) {
     char i, j;
@@ -623,4 +891,25 @@ char hsv2rgb(float h, float s, float v){
     b = (unsigned char)((bp+m)*3) ;
      //       
     return rgb(r,g,b) ;
+}
+
+// ==================================================
+// === convert HSV to a 24-bit color for the dither engine
+// ==================================================
+unsigned int hsv2rgb24(float h, float s, float v){
+    float C, X, m, rp, gp, bp ;
+    C = v * s;
+    X = C * (1.0 - fabsf(fmodf(h/60.0, 2.0) - 1.));
+    m = v - C;
+    if      ((0<=h) && (h<60))   { rp = C; gp = X; bp = 0;}
+    else if ((60<=h) && (h<120)) { rp = X; gp = C; bp = 0;}
+    else if ((120<=h) && (h<180)){ rp = 0; gp = C; bp = X;}
+    else if ((180<=h) && (h<240)){ rp = 0; gp = X; bp = C;}
+    else if ((240<=h) && (h<300)){ rp = X; gp = 0; bp = C;}
+    else if ((300<=h) && (h<360)){ rp = C; gp = 0; bp = X;}
+    else                         { rp = 0; gp = 0; bp = 0;}
+    // scale to 8 bits per channel
+    return rgb24((unsigned int)((rp+m)*255),
+                 (unsigned int)((gp+m)*255),
+                 (unsigned int)((bp+m)*255)) ;
 }
\ No newline at end of file
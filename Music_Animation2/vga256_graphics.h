@@ -5,6 +5,7 @@
  *
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
+ *  - PIO0_IRQ_0 (vsync irq 3, frame counter)
  *  - DMA channels 0, 1, 2, and 3
  *  - 153.6 kBytes of RAM (for pixel color data)
  *
@@ -34,6 +35,34 @@
 // defining colors
 #define rgb(r,g,b) (((r)<<5) & RED | ((g)<<2) & GREEN | ((b)<<0) & BLUE )
 
+// Frame service: vga_frame_count advances at the start of every vblank (60 Hz).
+// Each animation loop keeps its own vga_frames, and ends a frame with
+//     PT_YIELD_VBLANK(pt, &frames, 2) ;   // 30 fps, locked to the display
+// which yields until the next due vblank and counts the vblanks it missed.
+#define VGA_FRAME_HIST_BINS 32      // frame-to-frame time histogram bins
+#define VGA_FRAME_HIST_US   2000    // width of each bin (us)
+
+struct vga_frames {
+    unsigned int target ;       // vblank count the next frame waits for
+    unsigned int start_us ;     // time the current frame started
+    unsigned int busy_us ;      // time the last frame spent before waiting
+    unsigned int frames ;       // frames started
+    unsigned int overruns ;     // vblanks missed because a frame ran long
+    unsigned int histogram[VGA_FRAME_HIST_BINS] ;
+} ;
+
+extern volatile unsigned int vga_frame_count ;
+extern volatile unsigned int vga_vblank_time ;
+
+#define PT_YIELD_VBLANK(pt, frames, interval) do { \
+    vgaFrameDone((frames), (interval)) ; \
+    PT_YIELD_UNTIL((pt), (int)(vga_frame_count - (frames)->target) >= 0) ; \
+    vgaFrameStart(frames) ; \
+} while(0)
+
+// 24-bit (8 bits per channel) colors for the dither engine
+#define rgb24(r,g,b) ((((r) & 0xff)<<16) | (((g) & 0xff)<<8) | ((b) & 0xff))
+
 // VGA primitives - usable in main
 void initVGA(void) ;
 void drawPixel(short x, short y, char color) ;
@@ -51,6 +80,9 @@ void drawRoundRect(short x, short y, short w, short h, short r, char color) ;
 void fillRoundRect(short x, short y, short w, short h, short r, char color) ;
 void fillRect(short x, short y, short w, short h, char color) ;
 void fillRectDither(short x, short y, short w, short h, char color1, char color2) ;
+void bayerPattern(unsigned int color24, unsigned int pattern[4]) ;
+void fillRectPattern(short x, short y, short w, short h, unsigned int pattern[4]) ;
+void fillRectBayer(short x, short y, short w, short h, unsigned int color24) ;
 void drawChar(short x, short y, unsigned char c, char color, char bg, unsigned char size) ;
 void setCursor(short x, short y);
 void setTextColor(char c);
@@ -59,5 +91,10 @@ void setTextSize(unsigned char s);
 void setTextWrap(char w);
 void tft_write(unsigned char c) ;
 void writeString(char* str) ;
+// Frame service - usable in main
+void vgaFrameDone(struct vga_frames *frames, unsigned int interval) ;
+void vgaFrameStart(struct vga_frames *frames) ;
+void vgaFramePrint(struct vga_frames *frames) ;
 // added by Bruce (brl4)
-char hsv2rgb(float, float, float) ;
\ No newline at end of file
+char hsv2rgb(float, float, float) ;
+unsigned int hsv2rgb24(float, float, float) ;
\ No newline at end of file